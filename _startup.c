@@ -153,8 +153,9 @@ void __attribute__((naked)) _HardFault_Handler(uint32_t lr, void *psp, void *msp
     else
         frame = msp;
         
-    fiprintf(stderr, "** HARD FAULT **\r\n   pc=%p\r\n  msp=%p\r\n  psp=%p\r\n", 
-                    frame->pc, msp, psp);
+    LOG("** HARD FAULT **\r\n   pc=%p\r\n  msp=%p\r\n  psp=%p\r\n", 
+                    (uint32_t) frame->pc, (uint32_t) msp, (uint32_t) psp);
+    log_flush_err();
                     
     fault(0b1111111000);            // Blink LED and halt
 }
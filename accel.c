@@ -9,114 +9,235 @@
 #include <freedom.h>
 #include "common.h"
 
-#define MMA8451_I2C_ADDRESS (0x1d<<1)
-#define I2C_READ 1
-#define I2C_WRITE 0
-
-#define I2C0_B  I2C0_BASE_PTR
+static const I2cDev mma8451 = { .bus = 0, .addr = 0x1d };
 
 // ---------------------------------------------------------------------------
-// I2C bus control functions
+// MMA8451 control functions (over the I2C0 bus, see i2c.c)
 //
-inline void i2c_set_tx(I2C_MemMapPtr p)     {p->C1 |= I2C_C1_TX_MASK;}
-inline void i2c_set_rx(I2C_MemMapPtr p)     {p->C1 &= ~I2C_C1_TX_MASK;}
-inline void i2c_set_slave(I2C_MemMapPtr p)  {p->C1 &= ~I2C_C1_MST_MASK;}
-inline void i2c_set_master(I2C_MemMapPtr p) {p->C1 |=  I2C_C1_MST_MASK;}
-inline void i2c_give_nack(I2C_MemMapPtr p)  {p->C1 |= I2C_C1_TXAK_MASK;}
-inline void i2c_give_ack(I2C_MemMapPtr p)   {p->C1 &= ~I2C_C1_TXAK_MASK;}
-inline void i2c_repeated_start(I2C_MemMapPtr p){p->C1     |= I2C_C1_RSTA_MASK;}
-inline uint8_t i2c_read(I2C_MemMapPtr p)    {return p->D;}
-
-inline void i2c_start(I2C_MemMapPtr p)
+
+uint8_t mma8451_read(uint8_t addr)
 {
-    i2c_set_master(p);
-    i2c_set_tx(p);
+    uint8_t data = 0;
+
+    i2c_read_regs(&mma8451, addr, &data, 1);
+    return data;
 }
 
-inline void i2c_stop(I2C_MemMapPtr p)
+void mma8451_write(uint8_t addr, uint8_t data)
 {
-    i2c_set_slave(p);
-    i2c_set_rx(p);
+    i2c_write_reg(&mma8451, addr, data);
 }
 
-inline void i2c_wait(I2C_MemMapPtr p)
+#define STATUS    (0x00)                        // F_STATUS in FIFO mode
+#define OUT_X_MSB (0x01)
+#define F_SETUP   (0x09)
+#define CTRL_REG1 (0x2a)
+#define CTRL_REG4 (0x2d)
+#define CTRL_REG5 (0x2e)
+void accel_init(void)
 {
-    // Spin wait for the interrupt flag to be set
-    while((p->S & I2C_S_IICIF_MASK) == 0)
-        ;
+    uint8_t tmp;
 
-    p->S |= I2C_S_IICIF_MASK;           // Clear flag
+    i2c_init(0, 400000);                           // Fast mode
+    tmp = mma8451_read(CTRL_REG1);
+    mma8451_write(CTRL_REG1, tmp | 0x01);       // ACTIVE = 1
 }
 
-inline int i2c_write(I2C_MemMapPtr p, uint8_t data)
+// Signed 14-bit value from (MSB, LSB) register bytes
+static int16_t reg14(uint8_t *p)
 {
-    // Send data, wait, and return ACK status
-    p->D = data;
-    i2c_wait(p);
-    return ((p->S & I2C_S_RXAK_MASK) == 0);
+    return (int16_t)((p[0] << 8) | p[1]) >> 2;
 }
 
-inline void i2c_init(I2C_MemMapPtr p)
+// Read a signed 14-bit value from (reg, reg+1)
+int16_t _read_reg14(int reg)
 {
-    // Enable clocks
-    SIM_SCGC5 |= SIM_SCGC5_PORTE_MASK;      
-    SIM_SCGC4 |= SIM_SCGC4_I2C0_MASK;
-    
-    // Configure GPIO for I2C
-    PORTE_PCR24 = PORT_PCR_MUX(5);
-    PORTE_PCR25 = PORT_PCR_MUX(5);
-    
-    p->F  = 0x14;                   // Baudrate settings:  ICR=0x14, MULT=0
-    p->C1 = I2C_C1_IICEN_MASK;      // Enable:  IICEN=1
+    uint8_t data[2] = { 0, 0 };
+
+    i2c_read_regs(&mma8451, reg, data, 2);
+    return reg14(data);
 }
 
+//
+// accel_read_xyz() -- Read all three axes, in one I2C transfer
+//
+//      Reads STATUS and OUT_X_MSB..OUT_Z_LSB as one burst (the MMA8451
+//      auto-increments the register address), so the axes come from the
+//      same sample.  Returns 0, or -1 on a bus error.
+//
+int accel_read_xyz(AccelXYZ *a)
+{
+    uint8_t data[7];
+
+    if (i2c_read_regs(&mma8451, 0x00, data, sizeof(data)) != I2C_OK)
+        return -1;
+    a->status = data[0];
+    a->x = reg14(data + 1);
+    a->y = reg14(data + 3);
+    a->z = reg14(data + 5);
+    return 0;
+}
+
+// Read acceleration values for each axis
+int16_t accel_x(void) {return _read_reg14(0x01);}
+int16_t accel_y(void) {return _read_reg14(0x03);}
+int16_t accel_z(void) {return _read_reg14(0x05);}
+
 // ---------------------------------------------------------------------------
-// MMA8451 control functions
+// FIFO capture
+//
+// The MMA8451 collects samples in its 32-sample FIFO, and signals INT1
+// (PTA14) when it reaches the watermark.  The pin interrupt reads the FIFO
+// status and then the whole FIFO in one burst (in FIFO mode, the register
+// address wraps from OUT_Z_LSB back to OUT_X_MSB), all by queued I2C
+// transfers, at high priority so they go ahead of anything else waiting
+// for the bus.  The samples are timestamped into a record ring for
+// accel_fifo_read().
 //
+#define FIFO_SAMPLES    32
+#define SAMPLES_LEN     2048                    // Sample ring (about 102 samples)
+
+static uint8_t _sample_buffer[sizeof(RingBuffer) + SAMPLES_LEN] __attribute__ ((aligned(4)));
+static RingBuffer *const sample_buffer = (RingBuffer *) &_sample_buffer;
+
+static const uint8_t status_reg = STATUS, data_reg = OUT_X_MSB;
+static uint8_t fifo_data[1 + FIFO_SAMPLES * 6];  // F_STATUS, then the samples
+static I2cXfer fifo_xfer = { .dev = &mma8451, .priority = I2C_PRIO_HIGH };
+static uint8_t watermark;
+static uint32_t period_us;                      // Between samples
+static uint64_t irq_time;                       // When the watermark was reached
+static uint32_t overflows;
+
+// Output data rates (CTRL_REG1 DR = index), as sample periods
+static const uint32_t odr_periods[] = { 1250, 2500, 5000, 10000, 20000, 80000, 
+                                        160000, 640000 };
+
+// Listen for the watermark interrupt (active low, so level triggered:  a
+// FIFO still over the watermark after draining interrupts again)
+static void fifo_irq_enable(int enable)
+{
+    PORTA_PCR14 = PORT_PCR_ISF_MASK | PORT_PCR_MUX(1) | PORT_PCR_IRQC(enable ? 0x8 : 0);
+}
 
-uint8_t mma8451_read(uint8_t addr)
+// The FIFO has been read:  timestamp and save the samples.  The watermark
+// sample was the newest at the interrupt, and the rest are ODR periods apart.
+static void fifo_data_done(I2cXfer *x)
 {
-    delay(1);
-    i2c_start(I2C0_B);
-    i2c_write(I2C0_B, MMA8451_I2C_ADDRESS | I2C_WRITE);
-    i2c_write(I2C0_B, addr);
-    i2c_repeated_start(I2C0_B);
-    i2c_write(I2C0_B, MMA8451_I2C_ADDRESS | I2C_READ);
-    i2c_set_rx(I2C0_B);
-    i2c_give_nack(I2C0_B);
-    i2c_read(I2C0_B);
-    i2c_wait(I2C0_B);
-    i2c_stop(I2C0_B);
-    return i2c_read(I2C0_B);
+    AccelSample sample;
+    int n = x->rx_len / 6, i;
+    uint8_t *p = fifo_data + 1;
+
+    if (x->status == I2C_OK && period_us)      // (Not stopped meanwhile)
+        for(i=0; i<n; i++, p += 6) {
+            sample.time = irq_time + (int32_t) ((i + 1 - watermark) * period_us);
+            sample.x = reg14(p);
+            sample.y = reg14(p + 2);
+            sample.z = reg14(p + 4);
+            rec_write(sample_buffer, &sample, sizeof(sample));
+        }
+    if (period_us)
+        fifo_irq_enable(1);
 }
 
-void mma8451_write(uint8_t addr, uint8_t data)
+// The FIFO status has been read:  read all the samples it has
+static void fifo_status_done(I2cXfer *x)
 {
-    delay(1);
-    i2c_start(I2C0_B);
-    i2c_write(I2C0_B, MMA8451_I2C_ADDRESS | I2C_WRITE);
-    i2c_write(I2C0_B, addr);
-    i2c_write(I2C0_B, data);
-    i2c_stop(I2C0_B);
+    uint8_t status = fifo_data[0];
+
+    if (x->status != I2C_OK || (status & 0x3f) == 0 || period_us == 0) {
+        if (period_us)
+            fifo_irq_enable(1);
+        return;
+    }
+    if (status & 0x80)                          // F_OVF:  samples were lost
+        overflows++;
+    x->tx = &data_reg;
+    x->rx = fifo_data + 1;
+    x->rx_len = (status & 0x3f) * 6;
+    x->done = fifo_data_done;
+    i2c_submit(x);
 }
 
-#define CTRL_REG1 (0x2a)
-void accel_init(void)
+void PORTA_IRQHandler()
 {
-    uint8_t tmp;
+    if (!(PORTA_ISFR & (1 << 14)))
+        return;
+    irq_time = clock_us();
+    fifo_irq_enable(0);                         // Until the FIFO is drained
+
+    fifo_xfer.tx = &status_reg;
+    fifo_xfer.tx_len = 1;
+    fifo_xfer.rx = fifo_data;
+    fifo_xfer.rx_len = 1;
+    fifo_xfer.done = fifo_status_done;
+    i2c_submit(&fifo_xfer);
+}
 
-    i2c_init(I2C0_B);
-    tmp = mma8451_read(CTRL_REG1);
-    mma8451_write(CTRL_REG1, tmp | 0x01);       // ACTIVE = 1
+//
+// accel_fifo_start() -- Capture samples continuously through the FIFO
+//
+//      odr_hz is the sample rate:  800, 400, 200, 100, 50, 12 (12.5), 6
+//      (6.25) or 1 (1.56).  The FIFO is drained each time it holds wm
+//      (1-31) samples.  Returns 0, or -1 for an unsupported setting.  While
+//      capturing, accel_read_xyz() and accel_x() etc. would take samples 
+//      from the FIFO.
+//
+int accel_fifo_start(int odr_hz, int wm)
+{
+    static const uint16_t rates[] = { 800, 400, 200, 100, 50, 12, 6, 1 };
+    int dr;
+
+    for(dr=0; dr<8 && rates[dr] != odr_hz; dr++)
+        ;
+    if (dr == 8 || wm < 1 || wm >= FIFO_SAMPLES)
+        return -1;
+
+    accel_fifo_stop();
+    buf_reset(sample_buffer, SAMPLES_LEN);
+    buf_set_overwrite(sample_buffer, 1);
+    overflows = 0;
+    watermark = wm;
+    period_us = odr_periods[dr];
+
+    // Configure in standby:  circular FIFO, watermark interrupt on INT1
+    mma8451_write(CTRL_REG1, 0);
+    mma8451_write(F_SETUP, 0x40 | wm);          // F_MODE = 1, F_WMRK = wm
+    mma8451_write(CTRL_REG4, 0x40);             // INT_EN_FIFO
+    mma8451_write(CTRL_REG5, 0x40);             // INT_CFG_FIFO:  INT1
+
+    SIM_SCGC5 |= SIM_SCGC5_PORTA_MASK;
+    fifo_irq_enable(1);
+    enable_irq(INT_PORTA);
+    mma8451_write(CTRL_REG1, (dr << 3) | 0x01); // DR, ACTIVE = 1
+    return 0;
 }
 
-// Read a signed 14-bit value from (reg, reg+1)
-int16_t _read_reg14(int reg)
+// Stop FIFO capture, back to reading samples on demand (at 800Hz).  A
+// drain still in flight sees period_us = 0, and neither saves its samples
+// nor listens for the watermark again.
+void accel_fifo_stop(void)
 {
-    return (int16_t)((mma8451_read(reg) << 8) | mma8451_read(reg+1)) >> 2;
+    if (period_us == 0)
+        return;
+    period_us = 0;
+    fifo_irq_enable(0);
+    mma8451_write(CTRL_REG1, 0);
+    mma8451_write(CTRL_REG4, 0);
+    mma8451_write(F_SETUP, 0);
+    mma8451_write(CTRL_REG1, 0x01);
 }
 
-// Read acceleration values for each axis
-int16_t accel_x(void) {return _read_reg14(0x01);}
-int16_t accel_y(void) {return _read_reg14(0x03);}
-int16_t accel_z(void) {return _read_reg14(0x05);}
+// Next captured sample:  returns 0, or -1 if there's none
+int accel_fifo_read(AccelSample *sample)
+{
+    if (sample_buffer->size == 0)
+        return -1;
+    return rec_read(sample_buffer, sample, sizeof(*sample)) < 0 ? -1 : 0;
+}
+
+// Samples lost:  dropped from the ring, or FIFO overflows (each losing one
+// or more)
+uint32_t accel_fifo_drops(void)
+{
+    return rec_drops(sample_buffer) + overflows;
+}
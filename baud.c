@@ -0,0 +1,85 @@
+//
+// baud.c -- UART and I2C baud rate divisor search
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include "baud.h"
+
+// Error of an actual baud rate relative to the target, in parts per million
+uint32_t baud_error_ppm(uint32_t actual, uint32_t target)
+{
+    uint32_t diff = actual > target ? actual - target : target - actual;
+
+    return (uint32_t) (((uint64_t) diff * 1000000 + target / 2) / target);
+}
+
+//
+// baud_search_range() -- Find the OSR and SBR giving the closest rate to baud
+//
+//      Tries every OSR from osr_min to osr_max with the nearest SBR, and
+//      keeps the lowest error.  Ties go to the higher OSR, which samples
+//      each bit more times.  Returns 0, or -1 if no setting is possible
+//      (baud too high or zero) or the closest is more than BAUD_ERROR_MAX
+//      off.
+//
+int baud_search_range(uint32_t clock, uint32_t baud, int osr_min, int osr_max,
+                        BaudConfig *cfg)
+{
+    uint32_t osr, sbr, actual, err, best_err = 0xffffffff;
+
+    if (baud == 0 || baud > clock / osr_min)
+        return -1;
+
+    for(osr = osr_min; osr <= osr_max; osr++) {
+        sbr = (clock + osr * baud / 2) / (osr * baud);      // Round
+        if (sbr == 0)
+            sbr = 1;
+        if (sbr > BAUD_SBR_MAX)
+            sbr = BAUD_SBR_MAX;
+
+        actual = (clock + osr * sbr / 2) / (osr * sbr);
+        err = actual > baud ? actual - baud : baud - actual;
+        if (err <= best_err) {
+            best_err = err;
+            cfg->osr = osr;
+            cfg->sbr = sbr;
+            cfg->baud = actual;
+        }
+    }
+    return baud_error_ppm(cfg->baud, baud) > BAUD_ERROR_MAX ? -1 : 0;
+}
+
+// Search the full OSR range supported by UART0
+int baud_search(uint32_t clock, uint32_t baud, BaudConfig *cfg)
+{
+    return baud_search_range(clock, baud, BAUD_OSR_MIN, BAUD_OSR_MAX, cfg);
+}
+
+// I2C SCL dividers, indexed by the ICR field of the F register
+static const uint16_t i2c_dividers[64] = {
+      20,   22,   24,   26,   28,   30,   34,   40,   28,   32,   36,   40,   44,   48,   56,   68,
+      48,   56,   64,   72,   80,   88,  104,  128,   80,   96,  112,  128,  144,  160,  192,  240,
+     160,  192,  224,  256,  288,  320,  384,  480,  320,  384,  448,  512,  576,  640,  768,  960,
+     640,  768,  896, 1024, 1152, 1280, 1536, 1920, 1280, 1536, 1792, 2048, 2304, 2560, 3072, 3840,
+};
+
+//
+// i2c_baud_search() -- Find the ICR giving the fastest SCL rate up to rate
+//
+//      (With MULT = 0:  the KL25's I2C can't send a repeated START with a 
+//      multiplier, erratum e6070.)  Returns the actual rate, or -1 if even
+//      the largest divider is too fast.
+//
+int i2c_baud_search(uint32_t clock, uint32_t rate, uint8_t *icr)
+{
+    uint32_t best = 0xffffffff;
+    int i;
+
+    for(i=0; i<64; i++)
+        if (i2c_dividers[i] < best && (uint64_t) i2c_dividers[i] * rate >= clock) {
+            best = i2c_dividers[i];
+            *icr = i;
+        }
+    return best == 0xffffffff ? -1 : (int) (clock / best);
+}
@@ -0,0 +1,29 @@
+//
+// baud.h -- UART and I2C baud rate divisor search
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <stdint.h>
+
+// UART0 divides its clock by OSR (oversampling ratio, 4-32) and by the
+// 13-bit SBR divisor:  baud = clock / (osr * sbr).  UART1 and UART2 have
+// the same divisor, with OSR fixed at 16.
+#define BAUD_OSR_MIN    4
+#define BAUD_OSR_MAX    32
+#define BAUD_SBR_MAX    8191
+#define BAUD_ERROR_MAX  30000       // Most error accepted (ppm), 3%
+
+typedef struct {
+    uint8_t osr;                    // Oversampling ratio (4-32)
+    uint16_t sbr;                   // Baud rate divisor (1-8191)
+    uint32_t baud;                  // Resulting baud rate
+} BaudConfig;
+
+int baud_search(uint32_t clock, uint32_t baud, BaudConfig *cfg);
+int baud_search_range(uint32_t clock, uint32_t baud, int osr_min, int osr_max,
+                        BaudConfig *cfg);
+uint32_t baud_error_ppm(uint32_t actual, uint32_t target);
+
+// I2C:  SCL rate = clock / divider, with the divider chosen by the ICR (0-63)
+int i2c_baud_search(uint32_t clock, uint32_t rate, uint8_t *icr);
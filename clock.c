@@ -0,0 +1,104 @@
+//
+// clock.c -- Monotonic clock (SysTick)
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <freedom.h>
+#include "common.h"
+
+// SysTick counts down from CLOCK_PERIOD-1 at the core clock, and its handler
+// extends the count to 64 bits.  The period is a whole number of
+// microseconds, so the microsecond count is extended the same way and never
+// needs a 64-bit divide.
+#define CLOCK_PERIOD        (CLOCK_PERIOD_US * CLOCK_CYCLES_PER_US)
+#define CLOCK_PERIOD_US     349525      // Largest that fits 24 bits (16777200 cycles)
+
+static volatile uint64_t base_cycles;   // Counts at the start of this period
+static volatile uint64_t base_us;
+static uint32_t base_frac;              // Cycles added short of a whole microsecond
+
+// SysTick wrapped:  start a new period.  SysTick is left at the highest
+// priority (the default) so no clock reader can preempt this handler.
+void SysTick_Handler()
+{
+    base_cycles += CLOCK_PERIOD;
+    base_us += CLOCK_PERIOD_US;
+}
+
+// Read the base counts and the cycles into the current period, together
+static uint32_t clock_read(uint64_t *cycles, uint64_t *us)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t count;
+
+    __disable_irq();
+    *cycles = base_cycles;
+    *us = base_us;
+    count = SYST_CVR;
+
+    // If SysTick has wrapped but the handler hasn't run yet (interrupts
+    // were disabled), account for the new period here
+    if (SCB_ICSR & SCB_ICSR_PENDSTSET_MASK) {
+        *cycles += CLOCK_PERIOD;
+        *us += CLOCK_PERIOD_US;
+        count = SYST_CVR;
+    }
+    __set_PRIMASK(primask);
+    return CLOCK_PERIOD - 1 - count;
+}
+
+// Core clock cycles since clock_init()
+uint64_t clock_cycles(void)
+{
+    uint64_t cycles, us;
+    uint32_t elapsed = clock_read(&cycles, &us);
+
+    return cycles + elapsed;
+}
+
+// Microseconds since clock_init()
+uint64_t clock_us(void)
+{
+    uint64_t cycles, us;
+    uint32_t elapsed = clock_read(&cycles, &us);
+
+    return us + elapsed / CLOCK_CYCLES_PER_US;
+}
+
+//
+// clock_adjust() -- Account for time that SysTick didn't see while sleeping
+//
+//      SysTick runs from the core clock, which sleep modes can stop.  cycles
+//      is the time (in core clock cycles) that another timer measured since
+//      clock_cycles() returned since;  any part of it that SysTick missed is
+//      added to the clock.
+//
+void clock_adjust(uint64_t since, uint32_t cycles)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint32_t seen;
+
+    __disable_irq();
+    seen = clock_cycles() - since;
+    if (cycles > seen) {
+        base_cycles += cycles - seen;
+        base_frac += cycles - seen;
+        base_us += base_frac / CLOCK_CYCLES_PER_US;
+        base_frac %= CLOCK_CYCLES_PER_US;
+    }
+    __set_PRIMASK(primask);
+}
+
+void clock_init(void)
+{
+    SYST_CSR = 0;
+    base_cycles = 0;
+    base_us = 0;
+    base_frac = 0;
+    SYST_RVR = CLOCK_PERIOD - 1;
+    SYST_CVR = 0;                       // Reload now
+    SCB_ICSR = SCB_ICSR_PENDSTCLR_MASK;
+    SYST_CSR = SysTick_CSR_CLKSOURCE_MASK | SysTick_CSR_TICKINT_MASK 
+                | SysTick_CSR_ENABLE_MASK;
+}
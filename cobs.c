@@ -0,0 +1,144 @@
+//
+// cobs.c -- COBS framing with CRC-16
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include "cobs.h"
+
+#define CRC_INIT    0xffff
+
+// COBS encoder state:  each zero is replaced by a code byte giving the
+// distance to the next zero, and runs of 254 non-zero bytes get a code
+// byte with no zero.
+typedef struct {
+    uint8_t *code_p;                // Where the current code byte goes
+    uint8_t *out;
+    uint8_t code;
+} CobsEncoder;
+
+static void cobs_start(CobsEncoder *e, uint8_t *dst)
+{
+    e->code_p = dst;
+    e->out = dst + 1;
+    e->code = 1;
+}
+
+static void cobs_byte(CobsEncoder *e, uint8_t b)
+{
+    if (b == 0) {
+        *e->code_p = e->code;
+        e->code_p = e->out++;
+        e->code = 1;
+        return;
+    }
+    *e->out++ = b;
+    if (++e->code == 0xff) {
+        *e->code_p = e->code;
+        e->code_p = e->out++;
+        e->code = 1;
+    }
+}
+
+static int cobs_finish(CobsEncoder *e, uint8_t *dst)
+{
+    *e->code_p = e->code;
+    return e->out - dst;
+}
+
+//
+// cobs_encode() -- Encode len bytes so the result contains no zeros
+//
+//      dst must hold COBS_MAX(len) bytes.  Returns the encoded length.
+//
+int cobs_encode(const uint8_t *src, int len, uint8_t *dst)
+{
+    CobsEncoder e;
+
+    cobs_start(&e, dst);
+    while(len-- > 0)
+        cobs_byte(&e, *src++);
+    return cobs_finish(&e, dst);
+}
+
+//
+// cobs_decode() -- Decode len bytes of a COBS block (without the delimiter)
+//
+//      dst may be the same as src.  Returns the decoded length, or -1 if
+//      the block is malformed.
+//
+int cobs_decode(const uint8_t *src, int len, uint8_t *dst)
+{
+    const uint8_t *end = src + len;
+    uint8_t *out = dst;
+    int code, i;
+
+    while(src < end) {
+        code = *src++;
+        if (code == 0 || code - 1 > end - src)
+            return -1;
+        for(i=1; i<code; i++) {
+            if (*src == 0)
+                return -1;
+            *out++ = *src++;
+        }
+        if (code < 0xff && src < end)
+            *out++ = 0;
+    }
+    return out - dst;
+}
+
+// CRC-16/CCITT (polynomial 0x1021), a nibble at a time from a small table
+static const uint16_t crc_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+uint16_t crc16(uint16_t crc, const uint8_t *p, int len)
+{
+    while(len-- > 0) {
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (*p >> 4)];
+        crc = (crc << 4) ^ crc_table[(crc >> 12) ^ (*p++ & 0x0f)];
+    }
+    return crc;
+}
+
+//
+// frame_encode() -- Build a complete frame from a payload
+//
+//      dst must hold FRAME_MAX(len) bytes.  Returns the frame length,
+//      including the delimiter.
+//
+int frame_encode(const uint8_t *payload, int len, uint8_t *dst)
+{
+    uint16_t crc = crc16(CRC_INIT, payload, len);
+    CobsEncoder e;
+    int n;
+
+    cobs_start(&e, dst);
+    while(len-- > 0)
+        cobs_byte(&e, *payload++);
+    cobs_byte(&e, crc & 0xff);
+    cobs_byte(&e, crc >> 8);
+    n = cobs_finish(&e, dst);
+    dst[n++] = FRAME_DELIM;
+    return n;
+}
+
+//
+// frame_decode() -- Decode and check a frame (without the delimiter)
+//
+//      payload must hold len bytes, and may be the same as src.  Returns
+//      the payload length, or -1 if the frame is malformed or fails its CRC.
+//
+int frame_decode(const uint8_t *src, int len, uint8_t *payload)
+{
+    int n = cobs_decode(src, len, payload);
+
+    if (n < 2)
+        return -1;
+    n -= 2;
+    if (crc16(CRC_INIT, payload, n) != (payload[n] | (payload[n+1] << 8)))
+        return -1;
+    return n;
+}
@@ -0,0 +1,22 @@
+//
+// cobs.h -- COBS framing with CRC-16
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <stdint.h>
+
+// A frame is a payload with its CRC-16 appended (little endian), encoded
+// with Consistent Overhead Byte Stuffing so it contains no zero bytes, and
+// terminated by a zero.  A receiver can resynchronize at any zero.
+#define FRAME_DELIM         0x00
+
+// Worst case sizes:  COBS adds one byte per 254, plus one
+#define COBS_MAX(len)       ((len) + (len) / 254 + 1)
+#define FRAME_MAX(len)      (COBS_MAX((len) + 2) + 1)
+
+int cobs_encode(const uint8_t *src, int len, uint8_t *dst);
+int cobs_decode(const uint8_t *src, int len, uint8_t *dst);
+uint16_t crc16(uint16_t crc, const uint8_t *p, int len);
+int frame_encode(const uint8_t *payload, int len, uint8_t *dst);
+int frame_decode(const uint8_t *src, int len, uint8_t *payload);
@@ -15,13 +15,114 @@ void UART0_IRQHandler() __attribute__((interrupt("IRQ")));
 int uart_write(char *p, int len);
 int uart_write_err(char *p, int len);
 int uart_read(char *p, int len);
-void uart_init(int baud_rate);
+int uart_try_write(char *p, int len);
+int uart_try_read(char *p, int len);
+int uart_init(int baud_rate);
+void uart_set_overwrite(int enable);
+uint32_t uart_tx_drops(void);
+uint32_t uart_rx_drops(void);
+
+// UART0 (above) is the console.  All three UARTs can be used by port number:
+#define UART_PORTS 3
+void UART1_IRQHandler() __attribute__((interrupt("IRQ")));
+void UART2_IRQHandler() __attribute__((interrupt("IRQ")));
+int uart_port_init(int port, int baud_rate);
+int uart_port_write(int port, char *p, int len);
+int uart_port_try_write(int port, char *p, int len);
+int uart_port_read(int port, char *p, int len);
+int uart_port_try_read(int port, char *p, int len);
+void uart_port_set_overwrite(int port, int enable);
+uint32_t uart_port_tx_drops(int port);
+uint32_t uart_port_rx_drops(int port);
+
+// Receive flow control modes (uart_port_flow())
+#define UART_FLOW_NONE      0
+#define UART_FLOW_RTS       1
+#define UART_FLOW_XONXOFF   2
+int uart_port_flow(int port, int mode, GPIO_MemMapPtr rts_gpio, int rts_pin);
+
+// From clock.c
+#define CLOCK_CYCLES_PER_US (CORE_CLOCK / 1000000)
+void SysTick_Handler() __attribute__((interrupt("IRQ")));
+void clock_init(void);
+uint64_t clock_cycles(void);
+uint64_t clock_us(void);
+void clock_adjust(uint64_t since, uint32_t cycles);
+
+// From timer.c
+#define TIMER_HZ    1000                // Tick rate
+typedef struct Timer {
+    struct Timer *next;                 // In a wheel slot (internal)
+    struct Timer **pprev;               //   ...NULL when not pending
+    uint32_t expires;                   // Tick when due
+    void (*func)(struct Timer *t);      // Called from the timer interrupt
+    void *arg;                          // For use by func
+} Timer;
+void PIT_IRQHandler() __attribute__((interrupt("IRQ")));
+void timer_init(void);
+void timer_start(Timer *t, uint32_t ms, void (*func)(Timer *t), void *arg);
+void timer_cancel(Timer *t);
+static inline int timer_pending(Timer *t) { return t->pprev != 0; }
+uint32_t timer_ticks(void);
+uint32_t timer_next(uint32_t max);
+void timer_idle(int stop);
+uint32_t timer_resume(uint32_t stopped);
 
 // From delay.c
+void LPTimer_IRQHandler() __attribute__((interrupt("IRQ")));
 void delay(unsigned int ms);
+void delay_cycles(uint32_t cycles);
+
+// From i2c.c
+#define I2C_PENDING     1               // I2cXfer status
+#define I2C_OK          0
+#define I2C_NACK        -1              // Not acknowledged
+#define I2C_ARBLOST     -2              // Lost the bus to another master
+#define I2C_TIMEOUT     -3              // Took too long (the bus was reset)
+#define I2C_PRIO_LOW    0               // I2cXfer priority (the default)...
+#define I2C_PRIO_HIGH   1               //   ...e.g. for draining a sensor FIFO
+typedef struct {
+    uint8_t bus;                        // 0 (I2C0) or 1 (I2C1)
+    uint8_t addr;                       // 7-bit device address
+} I2cDev;
+typedef struct I2cXfer {
+    struct I2cXfer *next;               // In the queue (internal)
+    const I2cDev *dev;
+    uint8_t priority;                   // Higher runs first (I2C_PRIO_xxx)
+    uint8_t tx_len;                     // Bytes to write...
+    uint8_t rx_len;                     //   ...then to read
+    volatile int8_t status;             // I2C_PENDING until done
+    const uint8_t *tx;
+    uint8_t *rx;
+    void (*done)(struct I2cXfer *x);    // Called from the I2C interrupt, if set
+    void *arg;                          // For use by done
+} I2cXfer;
+void I2C0_IRQHandler() __attribute__((interrupt("IRQ")));
+void I2C1_IRQHandler() __attribute__((interrupt("IRQ")));
+void DMA2_IRQHandler() __attribute__((interrupt("IRQ")));
+void DMA3_IRQHandler() __attribute__((interrupt("IRQ")));
+int i2c_init(int bus, uint32_t rate);
+void i2c_submit(I2cXfer *x);
+int i2c_transfer(I2cXfer *x);
+int i2c_read_regs(const I2cDev *dev, uint8_t reg, uint8_t *data, int len);
+int i2c_write_reg(const I2cDev *dev, uint8_t reg, uint8_t data);
 
 // From accel.c
+typedef struct {
+    uint8_t status;                     // STATUS register (new data, overrun)
+    int16_t x, y, z;
+} AccelXYZ;
+typedef struct {
+    uint64_t time;                      // clock_us() when sampled (estimated)
+    int16_t x, y, z;
+} AccelSample;
 void accel_init(void);
+int accel_read_xyz(AccelXYZ *a);
+void PORTA_IRQHandler() __attribute__((interrupt("IRQ")));
+int accel_fifo_start(int odr_hz, int wm);
+void accel_fifo_stop(void);
+int accel_fifo_read(AccelSample *sample);
+uint32_t accel_fifo_drops(void);
 int16_t accel_x(void);
 int16_t accel_y(void);
 int16_t accel_z(void);
@@ -36,6 +137,33 @@ void fault(uint32_t pattern);
 #define FAULT_MEDIUM_BLINK 	(0b11110000111100001111000011110000)
 #define FAULT_SLOW_BLINK 	(0b11111111000000001111111100000000)
 
+// telemetry.c
+void tlm_init(int port);
+void tlm_time(uint32_t t);
+void tlm_accel(int16_t x, int16_t y, int16_t z);
+void tlm_touch(int channel, uint16_t count);
+void tlm_flush(void);
+
+// log.c -- Deferred logging.  LOG(fmt, args...) records only an ID for the
+// format string and up to LOG_ARGS_MAX 32-bit integer arguments (cast
+// pointers to uint32_t).  The strings are kept in the ELF file but not in
+// flash, and the host formats the records:  host/tlmdump -e demo.out
+#define LOG_ARGS_MAX        6
+#define LOG_RECORD_MAX      ((1 + LOG_ARGS_MAX) * 4)
+
+#define LOG(fmt, ...) do {                                                  \
+    static const char _log_fmt[] __attribute__((section(".logstr"))) = fmt; \
+    const uint32_t _log_args[] = { 0, ##__VA_ARGS__ };                     \
+    (void) sizeof(char[sizeof(_log_args) <= 4 * (1 + LOG_ARGS_MAX) ? 1 : -1]); \
+    log_write(_log_fmt, sizeof(_log_args) / 4 - 1, _log_args + 1);        \
+} while(0)
+
+void log_init(int port);
+void log_write(const char *fmt, int nargs, const uint32_t *args);
+void log_flush(void);
+void log_flush_err(void);
+uint32_t log_drops(void);
+
 // usb.c
 void usb_init(void);
 void usb_dump(void);
@@ -47,23 +175,103 @@ static inline void enable_irq(int n) {
 }
 // TODO:  IRQ disable
 
+#ifdef __arm__
 static inline void __enable_irq(void)	{ asm volatile ("cpsie i"); }
 static inline void __disable_irq(void)  { asm volatile ("cpsid i"); }
 
-// ring.c
-typedef struct {
-    volatile uint16_t head;
-    volatile uint16_t tail;
-    volatile uint16_t size;
-    volatile uint8_t data[];
-} RingBuffer;
-
-void buf_reset(RingBuffer *buf, int size);
-int buf_len(const RingBuffer *buf);
-int buf_isfull(const RingBuffer *buf);
-int buf_isempty(const RingBuffer *buf);
-uint8_t buf_get_byte(RingBuffer *buf);
-void buf_put_byte(RingBuffer *buf, uint8_t val);
+// Save and restore the interrupt mask, for critical sections that may be
+// entered with interrupts already disabled
+static inline uint32_t __get_PRIMASK(void)
+{
+    uint32_t primask;
+    asm volatile ("mrs %0, primask" : "=r" (primask));
+    return primask;
+}
+static inline void __set_PRIMASK(uint32_t primask)
+{
+    asm volatile ("msr primask, %0" : : "r" (primask) : "memory");
+}
+
+// Active exception number (0 in thread mode)
+static inline uint32_t __get_IPSR(void)
+{
+    uint32_t ipsr;
+    asm volatile ("mrs %0, ipsr" : "=r" (ipsr));
+    return ipsr;
+}
+
+static inline void __WFI(void)          { asm volatile ("wfi"); }
+#else
+// Host builds (tests) are single threaded
+static inline void __enable_irq(void)   { }
+static inline void __disable_irq(void)  { }
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { }
+static inline uint32_t __get_IPSR(void) { return 0; }
+static inline void __WFI(void)          { }
+#endif
+
+// sleep.c -- SLEEP_UNTIL(cond) waits for cond to become true, sleeping
+// until each interrupt.  cond must be made true by an interrupt handler
+// (or hardware).  In handler mode or with interrupts disabled, it spins.
+int sleep_allowed(void);
+void sleep_wait(void);
+void sleep_lock(void);
+void sleep_unlock(void);
+uint64_t sleep_us(void);
+uint32_t sleep_wakeups(void);
+uint32_t sleep_stops(void);
+
+#define SLEEP_UNTIL(cond) do {                                              \
+    if (sleep_allowed()) {                                                  \
+        __disable_irq();                                                    \
+        while(!(cond))                                                      \
+            sleep_wait();                                                   \
+        __enable_irq();                                                     \
+    } else {                                                                \
+        while(!(cond))                                                      \
+            ;                                                               \
+    }                                                                       \
+} while(0)
+
+// DMA channel assignments (channel n interrupts at DMAn_IRQHandler)
+#define DMA_UART0_TX        0
+#define DMA_UART0_RX        1
+#define DMA_I2C0            2
+#define DMA_I2C1            3
+
+// DMAMUX request sources
+#define DMAMUX_UART0_RX     2
+#define DMAMUX_UART0_TX     3
+#define DMAMUX_I2C0         22
+#define DMAMUX_I2C1         23
+
+// Reset a DMA channel, route a request source to it, and enable its interrupt
+static inline void dma_init(int channel, int source)
+{
+    SIM_SCGC6 |= SIM_SCGC6_DMAMUX_MASK;
+    SIM_SCGC7 |= SIM_SCGC7_DMA_MASK;
+    DMA_DCR(channel) = 0;
+    DMA_DSR_BCR(channel) = DMA_DSR_BCR_DONE_MASK;
+    DMAMUX0_CHCFG(channel) = 0;
+    DMAMUX0_CHCFG(channel) = DMAMUX_CHCFG_ENBL_MASK
+                                | DMAMUX_CHCFG_SOURCE(source);
+    enable_irq(INT_DMA0 + channel);
+}
+
+#include "ring.h"
+#include "baud.h"
+#include "cobs.h"
+#include "telemetry.h"
+#include "fmt.h"
+#include "delay.h"
+
+// Busy-wait at least us microseconds (delay.c)
+static inline void delay_us(uint32_t us)  { delay_cycles(delay_us_cycles(us, CORE_CLOCK)); }
+
+// uart.c formatted output, straight into the transmit buffer
+int uart_port_printf(int port, const char *fmt, ...);
+int uart_port_vprintf(int port, const char *fmt, va_list ap);
 
 // tests.c
 void tests(void);
@@ -7,7 +7,15 @@
 #include <freedom.h>
 #include "common.h"
 
-// delay(ms) -- Spin wait delay (in ms)
+// LPTMR compare:  turn off the interrupt, but leave TCF set for delay() to
+// see (writing 0 to TCF leaves it unchanged)
+void LPTimer_IRQHandler()
+{
+    LPTMR0_CSR &= ~(LPTMR_CSR_TIE_MASK | LPTMR_CSR_TCF_MASK);
+}
+
+// delay(ms) -- Wait delay (in ms), sleeping until the timer interrupt
+//              (or spinning, in handlers and with interrupts disabled)
 //              Note:  uses low power timer (LPTMR)
 void delay(unsigned int length_ms)
 {
@@ -19,9 +27,34 @@ void delay(unsigned int length_ms)
     LPTMR0_PSR = LPTMR_PSR_PCS(1) | LPTMR_PSR_PBYP_MASK;
     
     // Start the timer and wait for it to reach the compare value
-    LPTMR0_CSR = LPTMR_CSR_TEN_MASK;
-    while (!(LPTMR0_CSR & LPTMR_CSR_TCF_MASK))
-        ;
+    // (Sleeps can't use STOP mode, which needs the LPTMR for itself)
+    sleep_lock();
+    enable_irq(INT_LPTimer);
+    LPTMR0_CSR = LPTMR_CSR_TEN_MASK | LPTMR_CSR_TIE_MASK;
+    SLEEP_UNTIL(LPTMR0_CSR & LPTMR_CSR_TCF_MASK);
     
     LPTMR0_CSR = 0;                     // Turn off timer
+    sleep_unlock();
+}
+
+//
+// delay_cycles(n) -- Busy-wait at least n core clock cycles
+//
+//      Counts SysTick cycles (see clock.c), so it's exact whatever the
+//      flash wait states and interrupts, to within a loop iteration.  Works
+//      in handlers and with interrupts disabled.  Needs clock_init().
+//
+void delay_cycles(uint32_t cycles)
+{
+    uint32_t period = SYST_RVR + 1;
+    uint32_t last = SYST_CVR, now, elapsed;
+
+    for(;;) {
+        now = SYST_CVR;
+        elapsed = delay_elapsed(last, now, period);
+        if (elapsed >= cycles)
+            break;
+        cycles -= elapsed;
+        last = now;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+//
+// delay.h -- Cycle arithmetic for the busy-wait delays
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <stdint.h>
+
+// Cycles in us microseconds of a clock (in Hz), rounded up and saturating
+// at the longest wait.  With a constant clock of whole MHz, this is a
+// multiply.
+static inline uint32_t delay_us_cycles(uint32_t us, uint32_t clock)
+{
+    uint64_t cycles;
+
+    if (clock % 1000000 == 0)
+        cycles = (uint64_t) us * (clock / 1000000);
+    else
+        cycles = ((uint64_t) us * clock + 999999) / 1000000;
+    return cycles > UINT32_MAX ? UINT32_MAX : (uint32_t) cycles;
+}
+
+// Cycles a down-counter that reloads every period cycles (like SysTick) has
+// counted going from "from" to "to".  Correct as long as it's read at least
+// once a period.
+static inline uint32_t delay_elapsed(uint32_t from, uint32_t to, uint32_t period)
+{
+    return from >= to ? from - to : from + period - to;
+}
@@ -10,14 +10,93 @@
 
 extern char *_sbrk(int len);
 
+// Stream n samples of the inputs as binary telemetry (decode with tlmdump)
+static void stream_telemetry(int n)
+{
+    AccelXYZ a = { 0 };
+    int i;
+
+    fflush(stdout);
+    for(i=0; i<n; i++) {
+        tlm_time(clock_us());
+        accel_read_xyz(&a);
+        tlm_accel(a.x, a.y, a.z);
+        tlm_touch(9, touch_data(9));
+        tlm_touch(10, touch_data(10));
+    }
+    tlm_flush();
+}
+
+// Capture from the accelerometer FIFO at 800Hz for a second, and report
+static void accel_capture(void)
+{
+    AccelSample sample = { 0 }, first = { 0 };
+    uint64_t start = clock_us();
+    int n = 0;
+
+    accel_fifo_start(800, 16);
+    while (clock_us() - start < 1000000)
+        if (accel_fifo_read(&sample) == 0 && n++ == 0)
+            first = sample;
+    accel_fifo_stop();
+    iprintf("%d samples over %d ms, %d lost; last x=%d y=%d z=%d\r\n", n, 
+                (int) (sample.time - first.time) / 1000, (int) accel_fifo_drops(), 
+                sample.x, sample.y, sample.z);
+}
+
+#ifdef PRINTF_BENCH
+// Cycles per call to format the monitor's input line with fmt.c and with
+// newlib (build with -DPRINTF_BENCH; this links in newlib's formatter)
+static void printf_bench(void)
+{
+    char buf[80];
+    uint64_t start;
+    uint32_t fmt_cycles, newlib_cycles;
+    int i;
+
+    #define BENCH_CALLS 100
+    #define BENCH_LINE  "Inputs:  x=%5d   y=%5d   z=%5d ", -312, 4, 4101
+
+    start = clock_cycles();
+    for(i=0; i<BENCH_CALLS; i++)
+        fmt_snprintf(buf, sizeof(buf), BENCH_LINE);
+    fmt_cycles = clock_cycles() - start;
+
+    start = clock_cycles();
+    for(i=0; i<BENCH_CALLS; i++)
+        sniprintf(buf, sizeof(buf), BENCH_LINE);
+    newlib_cycles = clock_cycles() - start;
+
+    iprintf("cycles/call:  fmt %d, newlib %d\r\n", 
+                (int) fmt_cycles / BENCH_CALLS, (int) newlib_cycles / BENCH_CALLS);
+}
+#endif
+
+// Show the next bit of a pattern on the GREEN led, every 25ms until done
+static void blink(Timer *t)
+{
+    unsigned int *pattern = t->arg;
+
+    RGB_LED(0, *pattern & 1 ? 100 : 0, 0);             // Set GREEN led based on LSB
+    *pattern >>= 1;
+    if (*pattern)
+        timer_start(t, 25, blink, pattern);
+}
+
 // Main program
 int main(void)
 {
     char i;
     char *heap_end;
+    int c;
+    AccelXYZ a = { 0 };
     
     // Initialize all modules
+    clock_init();
+    timer_init();
     uart_init(115200);
+    tlm_init(0);                            // Telemetry on the console
+    log_init(0);                            // ...and log records
     accel_init();
     touch_init((1 << 9) | (1 << 10));       // Channels 9 and 10
     // usb_init();
@@ -26,13 +105,10 @@ int main(void)
     // Run tests
     tests();
 
-    // Blink the green LED to indicate booting
-    unsigned int pattern = 0b1100110011001100;
-    while(pattern) {
-        RGB_LED(0, pattern & 1 ? 100 : 0, 0);           // Set GREEN led based on LSB
-        pattern >>= 1;
-        delay(25);
-    }
+    // Blink the green LED to indicate booting (in the background)
+    static unsigned int pattern = 0b1100110011001100;
+    static Timer blink_timer = { .arg = &pattern };
+    blink(&blink_timer);
 
     // Welcome banner
     iprintf("\r\n\r\n====== Freescale Freedom FRDM-KL25Z\r\n");
@@ -46,10 +122,26 @@ int main(void)
     iprintf("%d bytes free\r\n", &i - heap_end);
     
     for(;;) {
+        log_flush();
         iprintf("monitor> ");
-        getchar();
+        c = getchar();
+        if (c == 't') {                     // 't' to stream telemetry
+            stream_telemetry(1000);
+            continue;
+        }
         iprintf("\r\n");
-        iprintf("Inputs:  x=%5d   y=%5d   z=%5d ", accel_x(), accel_y(), accel_z());
+        if (c == 'a')                       // 'a' for accelerometer capture
+            accel_capture();
+        if (c == 's')                       // 's' for time asleep
+            iprintf("Asleep %d of %d ms, %d wakeups (%d in STOP)\r\n", 
+                        (int) (sleep_us() / 1000), (int) (clock_us() / 1000),
+                        (int) sleep_wakeups(), (int) sleep_stops());
+#ifdef PRINTF_BENCH
+        if (c == 'p')
+            printf_bench();
+#endif
+        accel_read_xyz(&a);
+        iprintf("Inputs:  x=%5d   y=%5d   z=%5d ", a.x, a.y, a.z);
         iprintf("touch=(%d,%d)\r\n", touch_data(9), touch_data(10));
         // usb_dump();
     }
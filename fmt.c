@@ -0,0 +1,191 @@
+//
+// fmt.c -- Small integer-only formatted output
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+//  Supports %d %i %u %x %X %o %c %s %p and %%, with the '-' and '0' flags,
+//  width and precision (both may be '*').  Length modifiers are accepted
+//  and ignored, as int and long are both 32 bits on the target.
+//
+
+#include <string.h>
+#include "fmt.h"
+
+static void put(FmtSink *s, char c)
+{
+    if (s->p == s->end && s->more)
+        s->more(s);
+    if (s->p < s->end)
+        *s->p++ = c;
+    s->count++;
+}
+
+static void pad(FmtSink *s, char c, int n)
+{
+    while(n-- > 0)
+        put(s, c);
+}
+
+// Parse a width or precision (digits or '*'), leaving fmt at the next char
+static int parse_num(const char **fmt, va_list *ap)
+{
+    int n = 0;
+
+    if (**fmt == '*') {
+        (*fmt)++;
+        return va_arg(*ap, int);
+    }
+    while(**fmt >= '0' && **fmt <= '9')
+        n = n * 10 + *(*fmt)++ - '0';
+    return n;
+}
+
+//
+// fmt_vformat() -- Format to a sink.  Returns the number of characters
+//      formatted (including any dropped).
+//
+int fmt_vformat(FmtSink *s, const char *fmt, va_list ap)
+{
+    char digits[11], *d;                // 32 bits in octal
+    const char *str, *prefix, *hex;
+    unsigned int v;
+    int width, prec, left, zero, n, zeros, shift, base;
+    va_list args;
+
+    va_copy(args, ap);
+    s->count = 0;
+    for(; *fmt; fmt++) {
+        if (*fmt != '%') {
+            put(s, *fmt);
+            continue;
+        }
+
+        // Flags, width, precision, and (ignored) length
+        left = zero = 0;
+        for(fmt++; *fmt == '-' || *fmt == '0'; fmt++)
+            if (*fmt == '-')
+                left = 1;
+            else
+                zero = 1;
+        width = parse_num(&fmt, &args);
+        if (width < 0) {
+            left = 1;
+            width = -width;
+        }
+        prec = -1;
+        if (*fmt == '.') {
+            fmt++;
+            prec = parse_num(&fmt, &args);
+        }
+        while(*fmt == 'l' || *fmt == 'h' || *fmt == 'z' || *fmt == 'j' 
+                || *fmt == 't')
+            fmt++;
+
+        prefix = "";
+        base = shift = 0;
+        hex = "0123456789abcdef";
+        switch(*fmt) {
+         case 'd':
+         case 'i':
+            v = va_arg(args, int);
+            if ((int) v < 0) {
+                prefix = "-";
+                v = -v;
+            }
+            base = 10;
+            break;
+         case 'u':
+            v = va_arg(args, unsigned int);
+            base = 10;
+            break;
+         case 'X':
+            hex = "0123456789ABCDEF";
+            // Fall through
+         case 'x':
+            v = va_arg(args, unsigned int);
+            shift = 4;
+            break;
+         case 'o':
+            v = va_arg(args, unsigned int);
+            shift = 3;
+            break;
+         case 'p':
+            v = (unsigned int) (unsigned long) va_arg(args, void *);
+            prefix = "0x";
+            shift = 4;
+            break;
+         case 'c':
+            digits[0] = va_arg(args, int);
+            str = digits;
+            n = 1;
+            break;
+         case 's':
+            str = va_arg(args, const char *);
+            if (str == NULL)
+                str = "(null)";
+            for(n=0; str[n] && (prec < 0 || n < prec); n++)
+                ;
+            break;
+         case 0:
+            fmt--;                      // Stray '%' at the end
+            continue;
+         default:                       // Including %%
+            put(s, *fmt);
+            continue;
+        }
+
+        // Convert integers to digits, from the right
+        zeros = 0;
+        if (base || shift) {
+            d = digits + sizeof(digits);
+            if (v != 0 || prec != 0) {
+                do {
+                    if (shift) {            // Hex and octal without division
+                        *--d = hex[v & ((1 << shift) - 1)];
+                        v >>= shift;
+                    } else {
+                        *--d = '0' + v % 10;
+                        v /= 10;
+                    }
+                } while(v);
+            }
+            str = d;
+            n = digits + sizeof(digits) - d;
+            if (prec > n)
+                zeros = prec - n;
+            else if (zero && !left && prec < 0)
+                zeros = width - n - strlen(prefix);
+        }
+
+        width -= n + zeros + strlen(prefix);
+        if (!left)
+            pad(s, ' ', width);
+        while(*prefix)
+            put(s, *prefix++);
+        pad(s, '0', zeros);
+        while(n-- > 0)
+            put(s, *str++);
+        if (left)
+            pad(s, ' ', width);
+    }
+    va_end(args);
+    return s->count;
+}
+
+// Format into a buffer of size bytes (including the terminating zero).
+// Returns the length of the complete output, as snprintf() does.
+int fmt_snprintf(char *buf, int size, const char *fmt, ...)
+{
+    FmtSink s;
+    va_list ap;
+
+    s.p = buf;
+    s.end = size > 0 ? buf + size - 1 : buf;
+    s.more = NULL;
+    va_start(ap, fmt);
+    fmt_vformat(&s, fmt, ap);
+    va_end(ap);
+    if (size > 0)
+        *s.p = 0;
+    return s.count;
+}
@@ -0,0 +1,21 @@
+//
+// fmt.h -- Small integer-only formatted output
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <stddef.h>
+#include <stdarg.h>
+
+// Output goes to wherever a sink points:  characters are stored at p until
+// it reaches end, and then more() is called to provide more space.  If it
+// can't (or there's no more()), the rest of the output is dropped.
+typedef struct FmtSink {
+    char *p;                            // Next output position
+    char *end;                          // End of the space at p
+    void (*more)(struct FmtSink *s);    // Called when p == end
+    int count;                          // Characters formatted
+} FmtSink;
+
+int fmt_vformat(FmtSink *s, const char *fmt, va_list ap);
+int fmt_snprintf(char *buf, int size, const char *fmt, ...);
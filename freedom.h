@@ -7,6 +7,8 @@
 #include "MKL25Z4.h"                    // CPU definitions
 
 #define CORE_CLOCK          48000000    // Core clock speed
+#define BUS_CLOCK           24000000    // Bus clock (CORE_CLOCK / 2)
+#define XTAL_CLOCK          8000000     // External crystal (OSC0)
 
 static inline void RGB_LED(int red, int green, int blue) {
     TPM2_C0V  = red;
@@ -0,0 +1,86 @@
+//
+// baud_test.c -- Host unit tests for the UART baud rate search
+//
+//      Run with "make check"
+//
+
+#include <stdio.h>
+#include <assert.h>
+#include "baud.h"
+
+#define CLOCK   48000000
+
+// Check the search result for one rate:  valid register values, and an
+// error no worse than max_ppm
+static void check(uint32_t baud, uint32_t max_ppm)
+{
+    BaudConfig cfg;
+    uint32_t ppm;
+
+    assert(baud_search(CLOCK, baud, &cfg) == 0);
+    assert(cfg.osr >= BAUD_OSR_MIN && cfg.osr <= BAUD_OSR_MAX);
+    assert(cfg.sbr >= 1 && cfg.sbr <= BAUD_SBR_MAX);
+    assert(cfg.baud == (CLOCK + cfg.osr * cfg.sbr / 2) / (cfg.osr * cfg.sbr));
+
+    ppm = baud_error_ppm(cfg.baud, baud);
+    printf("%8u baud:  osr %2u sbr %4u -> %8u (%u ppm)\n", baud, cfg.osr, 
+                cfg.sbr, cfg.baud, ppm);
+    assert(ppm <= max_ppm);
+}
+
+int main(void)
+{
+    BaudConfig cfg;
+    uint8_t icr;
+
+    // The fixed 16x oversampling this replaces was 8.5% off at 460800 and up
+    check(9600, 0);
+    check(115200, 2000);
+    check(230400, 2000);
+    check(460800, 2000);
+    check(921600, 2000);
+    check(1000000, 0);
+    check(1500000, 0);
+    check(2000000, 0);
+    check(3000000, 0);
+    check(6000000, 0);
+    check(12000000, 0);                 // OSR 4, SBR 1
+    check(300, 1000);                   // Needs a large SBR
+
+    // Exact rates with several solutions prefer the highest OSR
+    assert(baud_search(CLOCK, 1000000, &cfg) == 0);
+    assert(cfg.osr == 24 && cfg.sbr == 2);
+
+    // UART1/2:  bus clock, fixed 16x oversampling
+    assert(baud_search_range(CLOCK / 2, 115200, 16, 16, &cfg) == 0);
+    assert(cfg.osr == 16 && cfg.sbr == 13 && cfg.baud == 115385);
+    assert(baud_search_range(CLOCK / 2, 1500000, 16, 16, &cfg) == 0);
+    assert(cfg.sbr == 1 && cfg.baud == 1500000);
+    assert(baud_search_range(CLOCK / 2, 1500001, 16, 16, &cfg) == -1);
+
+    // Too far off:  rejected, not rounded to the nearest divisor
+    assert(baud_search_range(CLOCK / 2, 1000000, 16, 16, &cfg) == -1);
+    assert(baud_search_range(CLOCK / 2, 1450000, 16, 16, &cfg) == -1);
+    assert(baud_search_range(CLOCK / 2, 1460000, 16, 16, &cfg) == 0);
+    assert(cfg.sbr == 1 && baud_error_ppm(cfg.baud, 1460000) <= BAUD_ERROR_MAX);
+
+    // Out of range
+    assert(baud_search(CLOCK, 0, &cfg) == -1);
+    assert(baud_search(CLOCK, 12000001, &cfg) == -1);
+
+    // I2C:  fastest SCL rate not over the target, from the bus clock
+    assert(i2c_baud_search(CLOCK / 2, 400000, &icr) == 375000 && icr == 0x12);
+    assert(i2c_baud_search(CLOCK / 2, 300000, &icr) == 300000 && icr == 0x14);
+    assert(i2c_baud_search(CLOCK / 2, 100000, &icr) == 100000 && icr == 0x1f);
+    assert(i2c_baud_search(CLOCK / 2, 1200000, &icr) == 1200000 && icr == 0x00);
+    assert(i2c_baud_search(CLOCK / 2, 5000000, &icr) == 1200000);
+    assert(i2c_baud_search(CLOCK / 2, 6250, &icr) == 6250 && icr == 0x3f);
+    assert(i2c_baud_search(CLOCK / 2, 6249, &icr) == -1);
+    assert(i2c_baud_search(CLOCK / 2, 0, &icr) == -1);
+
+    assert(baud_error_ppm(101, 100) == 10000);
+    assert(baud_error_ppm(99, 100) == 10000);
+
+    printf("baud_test:  passed\n");
+    return 0;
+}
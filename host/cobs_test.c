@@ -0,0 +1,83 @@
+//
+// cobs_test.c -- Host unit tests for COBS framing and CRC-16
+//
+//      Run with "make check"
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "cobs.h"
+
+#define MAXLEN  1024
+
+// Encode and decode one buffer, both raw and as a frame
+static void roundtrip(const uint8_t *src, int len)
+{
+    uint8_t enc[FRAME_MAX(MAXLEN)], dec[FRAME_MAX(MAXLEN)];
+    int i, n;
+
+    n = cobs_encode(src, len, enc);
+    assert(n <= COBS_MAX(len));
+    for(i=0; i<n; i++)
+        assert(enc[i] != 0);
+    assert(cobs_decode(enc, n, dec) == len);
+    assert(memcmp(src, dec, len) == 0);
+
+    n = frame_encode(src, len, enc);
+    assert(n <= FRAME_MAX(len));
+    assert(enc[n-1] == FRAME_DELIM);
+    for(i=0; i<n-1; i++)
+        assert(enc[i] != 0);
+    assert(frame_decode(enc, n - 1, dec) == len);
+    assert(memcmp(src, dec, len) == 0);
+
+    // Any single corrupted byte is caught
+    if (len > 0) {
+        i = rand() % (n - 1);
+        enc[i] ^= 1 << (rand() % 8);
+        if (enc[i] != 0)
+            assert(frame_decode(enc, n - 1, dec) == -1);
+    }
+}
+
+int main(void)
+{
+    uint8_t buf[MAXLEN];
+    uint8_t enc[16];
+    int i, len, trial;
+
+    // Known values
+    assert(crc16(0xffff, (const uint8_t *) "123456789", 9) == 0x29b1);
+    buf[0] = 0x11; buf[1] = 0x00; buf[2] = 0x00; buf[3] = 0x22;
+    assert(cobs_encode(buf, 4, enc) == 5);
+    assert(memcmp(enc, "\x02\x11\x01\x02\x22", 5) == 0);
+    assert(cobs_encode(buf, 0, enc) == 1 && enc[0] == 1);
+
+    // Edge cases:  empty, all zeros, runs around the 254 byte boundary
+    roundtrip(buf, 0);
+    memset(buf, 0, sizeof(buf));
+    roundtrip(buf, 1);
+    roundtrip(buf, 300);
+    memset(buf, 0x55, sizeof(buf));
+    for(len=250; len<=512; len++)
+        roundtrip(buf, len);
+
+    // Random contents, with and without many zeros
+    srand(1);
+    for(trial=0; trial<20000; trial++) {
+        len = rand() % MAXLEN;
+        for(i=0; i<len; i++)
+            buf[i] = (trial & 1) ? rand() : rand() % 4;
+        roundtrip(buf, len);
+    }
+
+    // Malformed blocks
+    assert(cobs_decode((const uint8_t *) "\x05\x11", 2, buf) == -1);
+    assert(cobs_decode((const uint8_t *) "\x02\x00", 2, buf) == -1);
+    assert(frame_decode((const uint8_t *) "\x01", 1, buf) == -1);
+
+    printf("cobs_test:  passed\n");
+    return 0;
+}
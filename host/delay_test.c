@@ -0,0 +1,71 @@
+//
+// delay_test.c -- Host unit tests for the busy-wait cycle arithmetic
+//
+//      Run with "make check"
+//
+
+#include <stdio.h>
+#include <assert.h>
+#include "delay.h"
+
+#define PERIOD  16777200                // SysTick period (see clock.c)
+
+// A simulated SysTick, read every step cycles
+static uint32_t counter;
+
+static uint32_t read_counter(uint32_t step)
+{
+    counter = counter >= step ? counter - step : counter + PERIOD - step;
+    return counter;
+}
+
+// The delay_cycles() loop, against the simulated counter:  returns the
+// cycles actually waited
+static uint32_t wait(uint32_t cycles, uint32_t step)
+{
+    uint32_t last = counter, now, elapsed, waited = 0;
+
+    for(;;) {
+        now = read_counter(step);
+        waited += step;
+        elapsed = delay_elapsed(last, now, PERIOD);
+        if (elapsed >= cycles)
+            return waited;
+        cycles -= elapsed;
+        last = now;
+    }
+}
+
+int main(void)
+{
+    uint32_t n, step, start, waited;
+
+    // Microseconds to cycles:  exact at whole MHz, else rounded up
+    assert(delay_us_cycles(0, 48000000) == 0);
+    assert(delay_us_cycles(1, 48000000) == 48);
+    assert(delay_us_cycles(1000, 48000000) == 48000);
+    assert(delay_us_cycles(1, 20971520) == 21);
+    assert(delay_us_cycles(1000000, 20971520) == 20971520);
+    assert(delay_us_cycles(89478485, 48000000) == 89478485U * 48);
+    assert(delay_us_cycles(89478486, 48000000) == UINT32_MAX);
+    assert(delay_us_cycles(UINT32_MAX, 48000000) == UINT32_MAX);
+
+    // Down-counter differences, across the reload
+    assert(delay_elapsed(100, 40, PERIOD) == 60);
+    assert(delay_elapsed(100, 100, PERIOD) == 0);
+    assert(delay_elapsed(10, PERIOD - 10, PERIOD) == 20);
+    assert(delay_elapsed(0, PERIOD - 1, PERIOD) == 1);
+
+    // The wait is never short, and at most one read late, wherever it 
+    // starts in the period
+    for(start=0; start<PERIOD; start += PERIOD / 97 + 1)
+        for(step=1; step<=4096; step *= 8)
+            for(n=0; n<3 * PERIOD && n / step < 100000; n = n * 3 + 7) {
+                counter = start;
+                waited = wait(n, step);
+                assert(waited >= n && waited <= n + step);
+            }
+
+    printf("delay_test:  passed\n");
+    return 0;
+}
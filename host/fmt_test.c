@@ -0,0 +1,66 @@
+//
+// fmt_test.c -- Host unit tests for the small formatter, against snprintf
+//
+//      Run with "make check"
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "fmt.h"
+
+static int failures;
+
+// Format with both, and compare
+#define CHECK(...) do {                                                 \
+    char a[128], b[128];                                                \
+    int na = fmt_snprintf(a, sizeof(a), __VA_ARGS__);                   \
+    int nb = snprintf(b, sizeof(b), __VA_ARGS__);                       \
+    if (na != nb || strcmp(a, b) != 0) {                                \
+        printf("%s:  got \"%s\" (%d), expected \"%s\" (%d)\n",         \
+                    #__VA_ARGS__, a, na, b, nb);                        \
+        failures++;                                                     \
+    }                                                                   \
+} while(0)
+
+int main(void)
+{
+    char buf[8];
+    int i;
+    static const int values[] = { 0, 1, -1, 7, 42, -42, 1000000, 
+                                  2147483647, -2147483647 - 1 };
+
+    CHECK("plain text");
+    CHECK("%%");
+    CHECK("%c%c%c", 'a', 'b', 'c');
+    CHECK("[%s] [%10s] [%-10s] [%.2s] [%*s]", "abc", "abc", "abc", "abc", 
+                5, "x");
+    CHECK("[%s]", "");
+
+    for(i=0; i<sizeof(values)/sizeof(values[0]); i++) {
+        CHECK("%d %i %u %x %X %o", values[i], values[i], values[i], 
+                    values[i], values[i], values[i]);
+        CHECK("[%5d] [%-5d] [%05d] [%.3d] [%8.3d] [%-8.3d]", values[i], 
+                    values[i], values[i], values[i], values[i], values[i]);
+        CHECK("[%08x] [%-8x] [%2x] [%.0d] [%*d] [%-*d]", values[i], 
+                    values[i], values[i], values[i], 6, values[i], 6, values[i]);
+        CHECK("%ld %lu %lx %hd", (long) values[i], (unsigned long) 
+                    (unsigned) values[i], (unsigned long) (unsigned) values[i],
+                    (short) values[i]);
+    }
+    CHECK("USB0_OTGSTAT=0x%x, OTGISTAT=0x%x, STAT=0x%x\r\n", 0x80, 0, 0x1f);
+    CHECK("Inputs:  x=%5d   y=%5d   z=%5d ", -312, 4, 4101);
+    CHECK("%p", (void *) 0x1ffff0c8);
+
+    // Truncation
+    assert(fmt_snprintf(buf, sizeof(buf), "%d", 123456789) == 9);
+    assert(strcmp(buf, "1234567") == 0);
+    assert(fmt_snprintf(buf, 0, "abc") == 3);
+
+    if (failures) {
+        printf("fmt_test:  %d failures\n", failures);
+        return 1;
+    }
+    printf("fmt_test:  passed\n");
+    return 0;
+}
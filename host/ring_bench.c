@@ -0,0 +1,87 @@
+//
+// ring_bench.c -- Host micro-benchmark for ring buffer operations
+//
+//      Built once per ring buffer mode (see "make bench").  Reports the
+//      cost per byte of the per-byte and span-based operations, in CPU
+//      cycles where the host has a cycle counter and nanoseconds otherwise.
+//      This compares the two modes on the host only:  it says nothing about
+//      cycle counts on the Cortex-M0+.
+//
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "ring.h"
+
+#define BUFLEN      128                 // Same as the UART buffers
+#define TOTAL       (64 * 1024 * 1024)  // Bytes moved per test
+#define CHUNK       48                  // Typical log line length
+
+static uint8_t _buf[sizeof(RingBuffer) + BUFLEN] __attribute__ ((aligned(4)));
+static RingBuffer *const buf = (RingBuffer *) &_buf;
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define UNITS "cycles"
+static uint64_t now(void) { return __rdtsc(); }
+#else
+#define UNITS "ns"
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+static volatile uint32_t sink;
+
+// Per-byte producer and consumer, as in the original UART paths
+static uint64_t bench_bytes(void)
+{
+    uint64_t start = now();
+    uint32_t sum = 0;
+    long n = 0;
+    int i;
+
+    while (n < TOTAL) {
+        for (i = 0; i < CHUNK && !buf_isfull(buf); i++)
+            buf_put_byte(buf, (uint8_t) i);
+        while (!buf_isempty(buf))
+            sum += buf_get_byte(buf);
+        n += i;
+    }
+    sink = sum;
+    return now() - start;
+}
+
+// Whole-chunk copies through buf_write() and buf_read()
+static uint64_t bench_spans(void)
+{
+    static uint8_t in[CHUNK], out[BUFLEN];
+    uint64_t start = now();
+    uint32_t sum = 0;
+    long n = 0;
+    int len;
+
+    while (n < TOTAL) {
+        n += buf_write(buf, in, CHUNK);
+        len = buf_read(buf, out, sizeof(out));
+        sum += out[len - 1];
+    }
+    sink = sum;
+    return now() - start;
+}
+
+int main(void)
+{
+    buf_reset(buf, BUFLEN);
+    printf("%s ring, %d byte buffer, %d usable\n",
+           RING_POW2 ? "power-of-two" : "wrap-check", BUFLEN, buf_space(buf));
+    printf("  put/get byte:    %6.2f %s/byte\n",
+           (double) bench_bytes() / TOTAL, UNITS);
+    printf("  write/read span: %6.2f %s/byte\n",
+           (double) bench_spans() / TOTAL, UNITS);
+    return 0;
+}
@@ -0,0 +1,267 @@
+//
+// timer_test.c -- Host tests for the timer wheel, on a simulated PIT
+//
+//      Run with "make check"
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include "timer.c"
+
+// Simulated PIT channel 0, counting bus clock cycles.  Each register
+// access leaves its slot in pit_reg[] for timer.c to read or write;  the
+// next access (or pit_sync()) acts on any write.
+uint32_t pit_reg[PIT_REGS];
+uint32_t host_reg;
+
+#define UNWRITTEN   0x80000000          // In a slot until written
+
+static uint64_t now;                    // Bus clock cycles
+static int pending;                     // NVIC pending bit for the PIT
+static int last = -1;                   // Register accessed last
+
+static struct {
+    int enabled;
+    int tif;
+    uint32_t ldval;
+    uint64_t start;                     // When the countdown began
+    uint32_t length;                    //   ...and its cycles
+} pit;
+
+// Reload the countdown each time it has run out
+static void pit_update(void)
+{
+    while (pit.enabled && now >= pit.start + pit.length) {
+        pit.start += pit.length;
+        pit.length = pit.ldval + 1;
+        pit.tif = 1;
+    }
+}
+
+// Act on the last register access, if it was a write
+static void pit_sync(void)
+{
+    int reg = last;
+    uint32_t val;
+
+    last = -1;
+    if (reg < 0 || (pit_reg[reg] & UNWRITTEN))
+        return;
+    val = pit_reg[reg];
+    pit_update();
+    switch (reg) {
+    case PIT_REG_TCTRL:
+        if ((val & PIT_TCTRL_TEN_MASK) && !pit.enabled) {
+            pit.start = now;
+            pit.length = pit.ldval + 1;
+        }
+        pit.enabled = (val & PIT_TCTRL_TEN_MASK) != 0;
+        break;
+    case PIT_REG_LDVAL:
+        pit.ldval = val;
+        break;
+    case PIT_REG_TFLG:
+        if (val & PIT_TFLG_TIF_MASK)
+            pit.tif = 0;
+        break;
+    case PIT_REG_ISPR:
+        pending = 1;
+        break;
+    }
+}
+
+int pit_access(int reg)
+{
+    pit_sync();
+    pit_update();
+    switch (reg) {
+    case PIT_REG_CVAL:                  // (Read only)
+        pit_reg[reg] = pit.enabled ? pit.length - 1 - (uint32_t) (now - pit.start) : 0;
+        return reg;
+    case PIT_REG_TFLG:
+        pit_reg[reg] = pit.tif | UNWRITTEN;
+        break;
+    default:
+        pit_reg[reg] = UNWRITTEN;
+        break;
+    }
+    last = reg;
+    return reg;
+}
+
+// Run the PIT interrupt for as long as it's pending
+static void service(void)
+{
+    pit_sync();
+    pit_update();
+    while (pit.tif || pending) {
+        pending = 0;
+        PIT_IRQHandler();
+        pit_sync();
+        pit_update();
+    }
+}
+
+#define TIMERS  3000
+
+static Timer timers[TIMERS];
+static uint32_t due[TIMERS];            // Tick each timer expires on
+static uint64_t due_base;               // Time the ticks count from
+static uint32_t tick_base;
+static int fired, idling, draining;
+
+static uint32_t random_ms(void)
+{
+    switch (rand() % 10) {
+    case 0:
+        return 1 + rand() % 300000;     // (Levels 2 and 3)
+    case 1:
+    case 2:
+        return 1 + rand() % 5000;
+    default:
+        return 1 + rand() % 64;
+    }
+}
+
+static void expired(Timer *t);
+
+static void start(int i, uint32_t ms)
+{
+    due[i] = ticks + ms;
+    timer_start(&timers[i], ms, expired, NULL);
+}
+
+// Each timer must fire once, on its tick.  When idling, that's never before
+// the tick's time, and late only by as much as a wakeup was (at most 5
+// ticks).  Some restart themselves, or start or cancel another.
+static void expired(Timer *t)
+{
+    int i = t - timers, j = rand() % TIMERS;
+    uint64_t when = due_base + (uint64_t) (due[i] - tick_base) * TIMER_PERIOD;
+
+    assert(ticks == due[i] && !timer_pending(t));
+    if (idling)
+        assert(now >= when && now < when + 6 * TIMER_PERIOD);
+    fired++;
+
+    if (draining)
+        return;
+    switch (rand() % 4) {
+    case 0:
+        start(i, random_ms());
+        break;
+    case 1:
+        timer_cancel(&timers[j]);
+        break;
+    case 2:
+        if (j != i)
+            start(j, random_ms());
+        break;
+    }
+}
+
+static int pending_timers(void)
+{
+    int i, n = 0;
+
+    for(i=0; i<TIMERS; i++)
+        n += timer_pending(&timers[i]);
+    return n;
+}
+
+// The wheel, one tick per PIT interrupt, across the tick counter wrapping
+static void wheel_tests(void)
+{
+    uint32_t i, n;
+
+    ticks = -100000;
+    for(n=0; n<400000; n++) {
+        i = rand() % TIMERS;
+        if (!timer_pending(&timers[i]) && rand() % 4 == 0)
+            start(i, random_ms());
+        PIT_IRQHandler();
+    }
+    draining = 1;
+    for(n=0; n<300000 && pending_timers(); n++)
+        PIT_IRQHandler();
+    assert(pending_timers() == 0);
+    assert(fired > 100000);
+
+    // Beyond the wheel's range:  parked, and re-inserted from there
+    start(0, WHEEL_RANGE + 1000);
+    for(n=0; n<WHEEL_RANGE + 1000 && timer_pending(&timers[0]); n++)
+        PIT_IRQHandler();
+    assert(n == WHEEL_RANGE + 1000 && !timer_pending(&timers[0]));
+}
+
+// Tickless idle, as sleep_wait() drives it:  the PIT is stretched to the
+// next tick with work, or stopped (as in STOP mode) for a time measured in
+// LPTMR counts.  Wakeups may come early, or late.
+#define STOP_COUNT  192                 // Bus cycles per LPTMR count
+
+static void idle_tests(void)
+{
+    uint32_t cycles, slept, n;
+    uint64_t wake;
+    int i, stop, early;
+
+    timer_init();
+    due_base = now;
+    tick_base = ticks;
+    idling = 1;
+    draining = 0;
+    fired = 0;
+
+    for(n=0; n<100000; n++) {
+        i = rand() % TIMERS;
+        if (!timer_pending(&timers[i]) && rand() % 3 == 0)
+            start(i, 1 + random_ms() % 20000);
+
+        // Busy for a while
+        if (rand() % 4 == 0) {
+            now += rand() % 5000;
+            service();
+            continue;
+        }
+
+        cycles = timer_next(60 * TIMER_HZ);
+        stop = cycles >= 10 * TIMER_PERIOD && rand() % 2;
+        timer_idle(stop);
+        slept = 0;
+        if (stop) {
+            if (cycles > 0xffffUL * STOP_COUNT)
+                cycles = 0xffffUL * STOP_COUNT;
+            slept = cycles / STOP_COUNT * STOP_COUNT;
+            if (rand() % 3 == 0)
+                slept = rand() % (slept + 1) / STOP_COUNT * STOP_COUNT;
+            if (rand() % 8 == 0)
+                slept += rand() % (5 * TIMER_PERIOD) / STOP_COUNT * STOP_COUNT;
+            now += slept;
+        } else {
+            // Until the PIT interrupt, or perhaps another one first
+            wake = now + rand() % 200000;
+            early = rand() % 2;
+            for(;;) {
+                pit_sync();
+                pit_update();
+                if (pit.tif || (early && now >= wake))
+                    break;
+                now += 97;
+            }
+            now += rand() % 300;
+        }
+        timer_resume(slept);
+        service();
+    }
+    assert(fired > 10000);
+}
+
+int main(void)
+{
+    srand(1);
+    wheel_tests();
+    idle_tests();
+    printf("timer_test:  passed\n");
+    return 0;
+}
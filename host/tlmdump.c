@@ -0,0 +1,213 @@
+//
+// tlmdump.c -- Decode and print a telemetry stream
+//
+//      Usage:  tlmdump [-e firmware.out] [file]    (e.g. /dev/ttyACM0)
+//
+//      Reads COBS frames from the file or stdin, and prints one line per
+//      record.  Bytes outside frames (such as console text) and damaged
+//      frames are counted and skipped.
+//
+//      Log records are formatted with the strings from the .logstr section
+//      of the firmware's ELF file, if given.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "cobs.h"
+#include "telemetry.h"
+
+#define FRAME_BUF   1024
+
+static const uint8_t sizes[TLM_TYPES] = TLM_SIZES;
+static long frames, bad_frames;
+
+// Log format strings, and their address in the firmware
+static char *logstr;
+static uint32_t logstr_addr, logstr_size;
+
+static int get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+    return get16(p) | ((uint32_t) get16(p + 2) << 16);
+}
+
+//
+// load_logstr() -- Read the .logstr section from a 32-bit little endian
+//      ELF file.  Returns 0, or -1 if the file or section isn't found.
+//
+static int load_logstr(const char *name)
+{
+    FILE *f = fopen(name, "rb");
+    uint8_t *elf, *sh, *names;
+    long size;
+    int i, shnum;
+
+    if (f == NULL)
+        return -1;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    elf = malloc(size);
+    if (elf == NULL || fread(elf, 1, size, f) != size || size < 52
+            || memcmp(elf, "\177ELF\1\1", 6) != 0) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    // Section headers (40 bytes each) and the section name table
+    sh = elf + get32(elf + 0x20);
+    shnum = get16(elf + 0x30);
+    names = elf + get32(sh + 40 * get16(elf + 0x32) + 16);
+
+    for(i=0; i<shnum; i++, sh += 40) {
+        if (strcmp((char *) names + get32(sh), ".logstr") == 0) {
+            logstr_addr = get32(sh + 12);
+            logstr = (char *) elf + get32(sh + 16);
+            logstr_size = get32(sh + 20);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Print a log record:  format ID and arguments
+static void print_log(const uint8_t *p, int len)
+{
+    uint32_t id = get32(p);
+    int nargs = (len - 4) / 4, arg = 0;
+    const char *fmt;
+    char spec[16];
+    int i, n;
+
+    if (!logstr || id - logstr_addr >= logstr_size) {
+        printf("log 0x%08x", id);
+        for(i=0; i<nargs; i++)
+            printf(" 0x%08x", get32(p + 4 + 4 * i));
+        printf("\n");
+        return;
+    }
+
+    // Format one conversion at a time.  All arguments are 32 bits, so
+    // length modifiers are dropped; strings are in target memory, so %s
+    // prints the address.
+    printf("log ");
+    for(fmt = logstr + (id - logstr_addr); *fmt; fmt++) {
+        if (*fmt != '%') {
+            if (*fmt != '\r' && !(*fmt == '\n' && fmt[1] == 0))
+                putchar(*fmt);
+            continue;
+        }
+        if (fmt[1] == '%') {
+            putchar(*++fmt);
+            continue;
+        }
+        spec[0] = '%';
+        n = 1;
+        while(*++fmt && strchr("diouxXcsp", *fmt) == NULL)
+            if (strchr("lhjzt", *fmt) == NULL && n < sizeof(spec) - 2)
+                spec[n++] = *fmt;
+        if (*fmt == 0)
+            break;
+        if (arg >= nargs) {
+            printf("<?>");
+            continue;
+        }
+        uint32_t v = get32(p + 4 + 4 * arg++);
+        spec[n++] = *fmt;
+        spec[n] = 0;
+        switch(*fmt) {
+         case 'd': case 'i': case 'c':
+            printf(spec, (int32_t) v);
+            break;
+         case 'o': case 'u': case 'x': case 'X':
+            printf(spec, (unsigned int) v);
+            break;
+         default:                   // p, s
+            printf("0x%08x", v);
+            break;
+        }
+    }
+    printf("\n");
+}
+
+// Print the records in a frame payload.  Returns -1 if it's malformed.
+static int print_records(const uint8_t *p, int len)
+{
+    const uint8_t *end = p + len;
+    int type;
+
+    while(p < end) {
+        type = *p++;
+        if (type <= 0 || type >= TLM_TYPES || sizes[type] > end - p)
+            return -1;
+        if (sizes[type] == 0) {             // Variable length, to the end
+            if (type == TLM_LOG && end - p >= 4 && (end - p) % 4 == 0)
+                print_log(p, end - p);
+            else
+                return -1;
+            break;
+        }
+        switch(type) {
+         case TLM_TIME:
+            printf("time %lu\n", (unsigned long) get16(p) 
+                                    | ((unsigned long) get16(p + 2) << 16));
+            break;
+         case TLM_ACCEL:
+            printf("accel %d %d %d\n", (int16_t) get16(p), 
+                                (int16_t) get16(p + 2), (int16_t) get16(p + 4));
+            break;
+         case TLM_TOUCH:
+            printf("touch %d %d\n", p[0], get16(p + 1));
+            break;
+        }
+        p += sizes[type];
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *f = stdin;
+    uint8_t buf[FRAME_BUF];
+    int c, n = 0, len;
+
+    if (argc > 2 && strcmp(argv[1], "-e") == 0) {
+        if (load_logstr(argv[2]) < 0) {
+            fprintf(stderr, "%s:  no .logstr section\n", argv[2]);
+            return 1;
+        }
+        argc -= 2;
+        argv += 2;
+    }
+    if (argc > 1 && (f = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    while((c = getc(f)) != EOF) {
+        if (c != FRAME_DELIM) {
+            if (n < FRAME_BUF)
+                buf[n] = c;
+            n++;
+            continue;
+        }
+        if (n > 0) {
+            len = n <= FRAME_BUF ? frame_decode(buf, n, buf) : -1;
+            if (len < 0 || print_records(buf, len) < 0)
+                bad_frames++;
+            else
+                frames++;
+        }
+        n = 0;
+        fflush(stdout);
+    }
+    fprintf(stderr, "tlmdump:  %ld frames, %ld bad\n", frames, bad_frames);
+    return 0;
+}
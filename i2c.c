@@ -0,0 +1,548 @@
+//
+// i2c.c -- Interrupt-driven I2C master (I2C0 and I2C1)
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <freedom.h>
+#include "common.h"
+
+#define I2C_BUSES       2
+#define I2C_READ        1
+#define I2C_WRITE       0
+#define I2C_BUS_FREE_US 2               // Bus free time between STOP and START (1.3us)
+#define I2C_BUS_FREE_CYCLES (I2C_BUS_FREE_US * (CORE_CLOCK / 1000000))
+#define I2C_RECOVER_US  5               // Half an SCL period, recovering the bus
+
+// Each transfer must finish (STOP included) within twice the time its bits
+// take at the bus rate, plus 1ms for interrupt latency.  If not, it fails
+// with I2C_TIMEOUT and the bus is reset and recovered.
+#define I2C_TIMEOUT_SLACK   (CORE_CLOCK / 1000)
+
+// Receive long reads by DMA:  all but the last two bytes of a read of at
+// least I2C_DMA_MIN bytes are moved by the bus's DMA channel, with one
+// completion interrupt instead of an interrupt per byte.  The last two are
+// received by the interrupt handler, which must NACK the last byte and send
+// STOP before reading it.  Set to 0 to receive by interrupts only.
+#ifndef I2C_DMA
+#define I2C_DMA 1
+#endif
+#define I2C_DMA_MIN     8
+
+// Where the interrupt handler is in the current transfer
+enum {
+    I2C_IDLE,                           // Bus free, nothing running
+    I2C_ADDR_W,                         // Sent the address, to write
+    I2C_TX,                             // Sent a byte
+    I2C_ADDR_R,                         // Sent the address, to read
+    I2C_RX,                             // Receiving
+    I2C_STOPPING,                       // Sent STOP, waiting for the bus to be free
+    I2C_WAITING,                        // Bus free, waiting out the bus free time
+    I2C_RECOVERING,                     // Freeing the bus, after a timeout
+};
+
+// Per bus state.  The transfers waiting for a bus are kept in priority
+// order (first come, first served within a priority), so a high priority
+// transfer goes ahead of everything waiting when it's queued, although not
+// ahead of the one already running.
+typedef struct {
+    I2C_MemMapPtr regs;
+    PORT_MemMapPtr port;                // SCL and SDA pins...
+    GPIO_MemMapPtr gpio;                //   ...and as GPIO, to recover the bus
+    uint8_t scl;
+    uint8_t sda;
+    uint8_t mux;                        // Pin function for I2C
+    uint8_t dma;                        // DMA channel, for long reads
+    I2cXfer *queue;                     // Waiting, highest priority first
+    I2cXfer *cur;                       // Running (NULL once STOP is sent)
+    uint8_t state;
+    uint8_t pos;                        // Bytes sent or received in this phase
+    uint8_t step;                       //   ...or steps taken, recovering
+    uint32_t rate;                      // SCL rate (0 until initialized)
+    uint8_t icr;                        // ...its divider, set at each START
+    uint32_t bit_cycles;                // Core clock cycles per SCL bit
+    uint64_t deadline;                  // clock_cycles() the transfer must end by
+                                        //   (or the next recovery step is due)
+    uint64_t free_at;                   //   ...the next START may be sent at
+    Timer timeout;                      // (Or the wait for free_at, or recovery)
+} I2cBus;
+
+static I2cBus buses[I2C_BUSES] = {
+    { I2C0_BASE_PTR, PORTE_BASE_PTR, PTE_BASE_PTR, 24, 25, 5, DMA_I2C0 },
+    { I2C1_BASE_PTR, PORTC_BASE_PTR, PTC_BASE_PTR, 1, 2, 2, DMA_I2C1 },
+};
+
+static void timed_out(Timer *t);
+
+// Take the first transfer off the queue, and start it
+static void start(I2cBus *b)
+{
+    I2cXfer *x = b->queue;
+    uint32_t bits = 9 * (1 + x->tx_len + (x->rx_len ? 1 + x->rx_len : 0)) + 2;
+    uint32_t cycles = 2 * bits * b->bit_cycles + I2C_TIMEOUT_SLACK;
+
+    b->queue = x->next;
+    b->cur = x;
+    b->deadline = clock_cycles() + cycles;
+    timer_start(&b->timeout, cycles / (CORE_CLOCK / 1000) + 1, timed_out, b);
+
+    b->pos = 0;
+    b->regs->F = I2C_F_ICR(b->icr);     // MULT = 0
+    b->regs->C1 = I2C_C1_IICEN_MASK | I2C_C1_IICIE_MASK | I2C_C1_MST_MASK
+                | I2C_C1_TX_MASK;       // Send START
+    if (x->tx_len || !x->rx_len) {
+        b->state = I2C_ADDR_W;
+        b->regs->D = (x->dev->addr << 1) | I2C_WRITE;
+    } else {
+        b->state = I2C_ADDR_R;
+        b->regs->D = (x->dev->addr << 1) | I2C_READ;
+    }
+}
+
+static void launch_later(Timer *t);
+
+// Start the first transfer on the queue once the bus has been free for
+// long enough.  That's usually so by the time there's another transfer to
+// start;  if not, it's started from the next timer tick, rather than by
+// waiting here (in an interrupt handler).
+static void launch(I2cBus *b)
+{
+    if (clock_cycles() >= b->free_at)
+        start(b);
+    else {
+        b->state = I2C_WAITING;
+        timer_start(&b->timeout, 1, launch_later, b);
+    }
+}
+
+static void launch_later(Timer *t)
+{
+    I2cBus *b = t->arg;
+
+    if (b->state == I2C_WAITING)
+        launch(b);
+}
+
+// Start the next transfer, if there is one (bus free)
+static void next(I2cBus *b)
+{
+    b->state = I2C_IDLE;
+    timer_cancel(&b->timeout);
+    if (b->queue)
+        launch(b);
+    else
+        sleep_unlock();
+}
+
+// The running transfer is done:  report it
+static void complete(I2cBus *b, int status)
+{
+    I2cXfer *x = b->cur;
+
+    b->cur = NULL;
+    b->state = I2C_STOPPING;
+    x->status = status;
+    if (x->done)
+        x->done(x);
+}
+
+// Send STOP and complete the transfer.  The next one starts from the STOP
+// interrupt, once the bus is free.
+static void finish(I2cBus *b, int status)
+{
+    b->regs->C1 &= ~(I2C_C1_MST_MASK | I2C_C1_TX_MASK | I2C_C1_TXAK_MASK);
+    complete(b, status);
+}
+
+// Drive a bus line as open drain:  high by letting the pull-up have it
+static void line(I2cBus *b, int pin, int high)
+{
+    if (high)
+        b->gpio->PDDR &= ~(1 << pin);
+    else
+        b->gpio->PDDR |= 1 << pin;
+}
+
+//
+// Freeing a stuck bus
+//
+//      A slave holding SDA low is part way through sending a byte (after a
+//      reset or an aborted transfer, say).  Clock SCL, up to 9 times, until
+//      it lets go, then send STOP.  recover_begin() takes the pins as GPIO,
+//      and each recover_step() moves a line, half an SCL period (at least)
+//      after the last.
+//
+#define RECOVER_CLOCK   18              // Steps clocking SCL, then 4 for STOP
+
+static void recover_begin(I2cBus *b)
+{
+    b->gpio->PCOR = (1 << b->scl) | (1 << b->sda);     // Low, when driven
+    b->gpio->PDDR &= ~((1 << b->scl) | (1 << b->sda));
+    PORT_PCR_REG(b->port, b->scl) = PORT_PCR_MUX(1);
+    PORT_PCR_REG(b->port, b->sda) = PORT_PCR_MUX(1);
+    b->step = 0;
+}
+
+// Returns 0 once done (the pins given back to the I2C module)
+static int recover_step(I2cBus *b)
+{
+    int n = b->step++;
+
+    if (n < RECOVER_CLOCK) {
+        if (n % 2 || !(b->gpio->PDIR & (1 << b->sda))) {
+            line(b, b->scl, n % 2);
+            return 1;
+        }
+        n = RECOVER_CLOCK;              // SDA let go:  on to STOP
+        b->step = n + 1;
+    }
+
+    // STOP:  SDA goes high while SCL is high
+    switch(n - RECOVER_CLOCK) {
+     case 0:
+        line(b, b->scl, 0);
+        return 1;
+     case 1:
+        line(b, b->sda, 0);
+        return 1;
+     case 2:
+        line(b, b->scl, 1);
+        return 1;
+     case 3:
+        line(b, b->sda, 1);
+        return 1;
+    }
+    PORT_PCR_REG(b->port, b->scl) = PORT_PCR_MUX(b->mux);
+    PORT_PCR_REG(b->port, b->sda) = PORT_PCR_MUX(b->mux);
+    return 0;
+}
+
+// Free a stuck bus, waiting (at init)
+static void recover(I2cBus *b)
+{
+    recover_begin(b);
+    do
+        delay_us(I2C_RECOVER_US);
+    while (recover_step(b));
+}
+
+// Free a stuck bus a step per timer tick (after a timeout, in an interrupt
+// handler), then go on with the next transfer.  i2c_transfer() takes the
+// steps itself when polling, at deadline.
+static void recovering(Timer *t)
+{
+    I2cBus *b = t->arg;
+
+    if (recover_step(b)) {
+        b->deadline = clock_cycles() + I2C_RECOVER_US * (CORE_CLOCK / 1000000);
+        timer_start(t, 1, recovering, b);
+        return;
+    }
+    b->regs->FLT = I2C_FLT_STOPIE_MASK | I2C_FLT_STOPF_MASK;
+    b->regs->S = I2C_S_IICIF_MASK | I2C_S_ARBL_MASK;
+    b->regs->C1 = I2C_C1_IICEN_MASK | I2C_C1_IICIE_MASK;
+    next(b);
+}
+
+// The transfer (or the STOP after it) took too long:  reset the module,
+// fail the transfer, and recover the bus (see recovering())
+static void abort_xfer(I2cBus *b)
+{
+#if I2C_DMA
+    DMA_DCR(b->dma) = 0;
+    DMA_DSR_BCR(b->dma) = DMA_DSR_BCR_DONE_MASK;
+#endif
+    b->regs->C1 = 0;
+    if (b->state != I2C_STOPPING)
+        complete(b, I2C_TIMEOUT);
+
+    b->state = I2C_RECOVERING;
+    recover_begin(b);
+    b->deadline = clock_cycles() + I2C_RECOVER_US * (CORE_CLOCK / 1000000);
+    timer_start(&b->timeout, 1, recovering, b);
+}
+
+static void timed_out(Timer *t)
+{
+    I2cBus *b = t->arg;
+
+    if (b->state != I2C_IDLE)
+        abort_xfer(b);
+}
+
+// A byte has been received
+static void rx_byte(I2cBus *b)
+{
+    I2cXfer *x = b->cur;
+
+    // Reading the data starts receiving the next byte, so send STOP
+    // before reading the last one, and NACK it before that
+    if (b->pos == x->rx_len - 1) {
+        b->regs->C1 &= ~(I2C_C1_MST_MASK | I2C_C1_TX_MASK | I2C_C1_TXAK_MASK);
+        x->rx[b->pos++] = b->regs->D;
+        complete(b, I2C_OK);
+    } else {
+        if (b->pos == x->rx_len - 2)
+            b->regs->C1 |= I2C_C1_TXAK_MASK;
+        x->rx[b->pos++] = b->regs->D;
+    }
+}
+
+#if I2C_DMA
+// Receive the first rx_len - 2 bytes by DMA, with the I2C interrupt off
+static void rx_dma_start(I2cBus *b)
+{
+    I2cXfer *x = b->cur;
+
+    b->regs->C1 &= ~(I2C_C1_TX_MASK | I2C_C1_TXAK_MASK | I2C_C1_IICIE_MASK);
+    DMA_DAR(b->dma) = (uint32_t) x->rx;
+    DMA_DSR_BCR(b->dma) = DMA_DSR_BCR_BCR(x->rx_len - 2);
+    DMA_DCR(b->dma) = DMA_DCR_EINT_MASK | DMA_DCR_ERQ_MASK
+                    | DMA_DCR_CS_MASK | DMA_DCR_DINC_MASK | DMA_DCR_SSIZE(1)
+                    | DMA_DCR_DSIZE(1) | DMA_DCR_D_REQ_MASK;
+    b->pos = x->rx_len - 2;
+    b->regs->C1 |= I2C_C1_DMAEN_MASK;
+}
+
+// The DMA block is done, and the next to last byte is on its way:  go back
+// to interrupts.  (TXAK now would NACK that byte, not the last, so that's
+// left to rx_byte() once it's in.)
+static void rx_dma_done(I2cBus *b)
+{
+    DMA_DSR_BCR(b->dma) = DMA_DSR_BCR_DONE_MASK;
+    b->regs->C1 = (b->regs->C1 & ~I2C_C1_DMAEN_MASK) | I2C_C1_IICIE_MASK;
+    if (b->regs->S & I2C_S_TCF_MASK)            // Already here?
+        rx_byte(b);
+}
+
+void DMA2_IRQHandler() { rx_dma_done(&buses[0]); }
+void DMA3_IRQHandler() { rx_dma_done(&buses[1]); }
+#endif
+
+// Move the current transfer along, after each byte (and each STOP)
+static void service(I2cBus *b)
+{
+    I2C_MemMapPtr regs = b->regs;
+    I2cXfer *x = b->cur;
+    uint8_t s = regs->S;
+
+    if (regs->FLT & I2C_FLT_STOPF_MASK) {       // STOP seen:  bus is free
+        regs->FLT |= I2C_FLT_STOPF_MASK;
+        regs->S = I2C_S_IICIF_MASK;
+        b->free_at = clock_cycles() + I2C_BUS_FREE_CYCLES;
+        if (b->state == I2C_STOPPING)
+            next(b);
+        return;
+    }
+    if (!(s & I2C_S_IICIF_MASK))
+        return;
+    regs->S = I2C_S_IICIF_MASK;
+
+    if (s & I2C_S_ARBL_MASK) {                  // Lost the bus to another master
+        regs->S = I2C_S_ARBL_MASK;
+        if (x) {
+            complete(b, I2C_ARBLOST);
+            next(b);
+        }
+        return;
+    }
+
+    switch(b->state) {
+     case I2C_ADDR_W:
+     case I2C_TX:
+        if (s & I2C_S_RXAK_MASK)
+            finish(b, I2C_NACK);
+        else if (b->pos < x->tx_len) {
+            b->state = I2C_TX;
+            regs->D = x->tx[b->pos++];
+        } else if (x->rx_len) {
+            b->state = I2C_ADDR_R;
+            b->pos = 0;
+            regs->C1 |= I2C_C1_RSTA_MASK;       // Repeated START, to read
+            regs->D = (x->dev->addr << 1) | I2C_READ;
+        } else
+            finish(b, I2C_OK);
+        break;
+
+     case I2C_ADDR_R:
+        if (s & I2C_S_RXAK_MASK) {
+            finish(b, I2C_NACK);
+            break;
+        }
+        // Switch to receive, NACKing the first byte if it's the last
+        b->state = I2C_RX;
+#if I2C_DMA
+        if (x->rx_len >= I2C_DMA_MIN)
+            rx_dma_start(b);
+        else
+#endif
+        if (x->rx_len == 1)
+            regs->C1 = (regs->C1 & ~I2C_C1_TX_MASK) | I2C_C1_TXAK_MASK;
+        else
+            regs->C1 &= ~(I2C_C1_TX_MASK | I2C_C1_TXAK_MASK);
+        (void) regs->D;                         // Dummy read starts receiving
+        break;
+
+     case I2C_RX:
+        if (s & I2C_S_TCF_MASK)                 // (Not if rx_dma_done() got it)
+            rx_byte(b);
+        break;
+    }
+}
+
+void I2C0_IRQHandler() { service(&buses[0]); }
+void I2C1_IRQHandler() { service(&buses[1]); }
+
+//
+// i2c_submit() -- Queue a transfer, on its device's bus
+//
+//      Writes tx_len bytes from tx, then (after a repeated START) reads
+//      rx_len bytes into rx.  Either may be 0.  x->status is I2C_PENDING
+//      until the transfer is done, then I2C_OK or an error, and x->done(x)
+//      (if set) is called from the I2C interrupt.  x must stay put until
+//      then.
+//
+//      Transfers run in order of x->priority, then of submission.
+//
+void i2c_submit(I2cXfer *x)
+{
+    I2cBus *b = &buses[x->dev->bus];
+    uint32_t primask = __get_PRIMASK();
+    I2cXfer **p;
+
+    x->status = I2C_PENDING;
+
+    __disable_irq();
+    for(p = &b->queue; *p && (*p)->priority >= x->priority; p = &(*p)->next)
+        ;
+    x->next = *p;
+    *p = x;
+    if (b->state == I2C_IDLE) {
+        sleep_lock();                   // The bus clock stops in STOP mode
+        launch(b);
+    }
+    __set_PRIMASK(primask);
+}
+
+//
+// i2c_transfer() -- Run a transfer, and wait for it to finish
+//
+//      Returns I2C_OK or an error.  Sleeps while waiting; where interrupts
+//      can't be taken, runs the bus (and everything queued ahead on it) by
+//      polling instead.  Either way, the wait is bounded by the transfer
+//      timeouts.
+//
+int i2c_transfer(I2cXfer *x)
+{
+    I2cBus *b = &buses[x->dev->bus];
+
+    i2c_submit(x);
+    if (sleep_allowed())
+        SLEEP_UNTIL(x->status != I2C_PENDING);
+    else
+        while (x->status == I2C_PENDING) {
+            if ((b->regs->S & I2C_S_IICIF_MASK)
+                    || (b->regs->FLT & I2C_FLT_STOPF_MASK))
+                service(b);
+#if I2C_DMA
+            if (DMA_DSR_BCR(b->dma) & DMA_DSR_BCR_DONE_MASK)
+                rx_dma_done(b);
+#endif
+            if (b->state == I2C_WAITING) {      // (No timer ticks here)
+                if (clock_cycles() >= b->free_at)
+                    start(b);
+            } else if (b->state == I2C_RECOVERING) {
+                if (clock_cycles() >= b->deadline)
+                    recovering(&b->timeout);
+            } else if (b->state != I2C_IDLE && clock_cycles() > b->deadline)
+                abort_xfer(b);
+        }
+    return x->status;
+}
+
+// Read len registers of a device, starting at reg
+int i2c_read_regs(const I2cDev *dev, uint8_t reg, uint8_t *data, int len)
+{
+    I2cXfer x = { .dev = dev, .tx = &reg, .tx_len = 1, .rx = data, .rx_len = len };
+
+    return i2c_transfer(&x);
+}
+
+// Write one register of a device
+int i2c_write_reg(const I2cDev *dev, uint8_t reg, uint8_t data)
+{
+    uint8_t buf[2] = { reg, data };
+    I2cXfer x = { .dev = dev, .tx = buf, .tx_len = 2 };
+
+    return i2c_transfer(&x);
+}
+
+//
+// i2c_init() -- Initialize an I2C bus, for SCL rate
+//
+//      I2C0:  SCL on PTE24, SDA on PTE25 (the accelerometer)
+//      I2C1:  SCL on PTC1, SDA on PTC2 (ALT2; A5 and A4 on the headers)
+//
+//      Needs clock_init() and timer_init(), for the transfer timeouts.
+//      Returns the rate actually achieved (at most rate, e.g. 375kHz for
+//      400kHz fast mode), or -1 if it's too low.
+//
+//      Each driver on a bus calls this, with the fastest rate its device
+//      allows, and the bus runs at the slowest of them:  a slower device
+//      lowers the rate from the next transfer on.  The first call sets the
+//      bus up.
+//
+int i2c_init(int bus, uint32_t rate)
+{
+    I2cBus *b;
+    uint8_t icr;
+    int actual;
+    uint32_t primask;
+
+    if (bus < 0 || bus >= I2C_BUSES)
+        return -1;
+    b = &buses[bus];
+    if (b->rate && rate >= b->rate)
+        return b->rate;
+
+    actual = i2c_baud_search(BUS_CLOCK, rate, &icr);
+    if (actual < 0)
+        return -1;
+
+    primask = __get_PRIMASK();
+    __disable_irq();
+    b->icr = icr;
+    b->bit_cycles = CORE_CLOCK / actual;
+    __set_PRIMASK(primask);
+    if (b->rate) {                      // Already set up:  just slower
+        b->rate = actual;
+        return actual;
+    }
+
+    // Enable clocks
+    switch(bus) {
+     case 0:
+        SIM_SCGC5 |= SIM_SCGC5_PORTE_MASK;
+        SIM_SCGC4 |= SIM_SCGC4_I2C0_MASK;
+        break;
+     case 1:
+        SIM_SCGC5 |= SIM_SCGC5_PORTC_MASK;
+        SIM_SCGC4 |= SIM_SCGC4_I2C1_MASK;
+        break;
+    }
+
+    // Free the bus (from a reset mid-transfer), and configure GPIO for I2C
+    b->regs->C1 = 0;
+    recover(b);
+
+    b->regs->FLT = I2C_FLT_STOPIE_MASK; // Interrupt on STOP, too
+    b->regs->C1 = I2C_C1_IICEN_MASK | I2C_C1_IICIE_MASK;
+    enable_irq(bus ? INT_I2C1 : INT_I2C0);
+
+#if I2C_DMA
+    dma_init(b->dma, bus ? DMAMUX_I2C1 : DMAMUX_I2C0);
+    DMA_SAR(b->dma) = (uint32_t) &b->regs->D;
+#endif
+    b->rate = actual;
+    return actual;
+}
@@ -0,0 +1,100 @@
+//
+// log.c -- Deferred (tokenized) logging
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <string.h>
+#include <freedom.h>
+#include "common.h"
+
+// Log records are kept in an overwrite mode record ring, so logging never
+// waits:  if the ring is full, the oldest records are dropped (see
+// log_drops()).  Each record is the format ID followed by the arguments.
+#define LOGLEN 512
+
+static uint8_t _log_buffer[sizeof(RingBuffer) + LOGLEN] __attribute__ ((aligned(4)));
+static RingBuffer *const log_buffer = (RingBuffer *) &_log_buffer;
+
+static int log_port;
+
+// The ring is set up on first use, so LOG() works before log_init()
+static void log_setup(void)
+{
+    if (log_buffer->size == 0) {
+        buf_reset(log_buffer, LOGLEN);
+        buf_set_overwrite(log_buffer, 1);
+    }
+}
+
+// Add a record (called by LOG()).  Interrupts are disabled briefly, as the
+// ring has one producer and LOG() can be used from any context (including
+// with interrupts already disabled).
+void log_write(const char *fmt, int nargs, const uint32_t *args)
+{
+    uint8_t *p;
+    int len = (1 + nargs) * sizeof(uint32_t);
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    log_setup();
+    if ((p = rec_reserve(log_buffer, len)) != NULL) {
+        *(uint32_t *) p = (uint32_t) fmt;
+        memcpy(p + sizeof(uint32_t), args, nargs * sizeof(uint32_t));
+        rec_commit(log_buffer, len);
+    }
+    __set_PRIMASK(primask);
+}
+
+// Send each record as a telemetry frame, with the given write function
+static void log_drain(int (*write)(char *p, int len))
+{
+    uint8_t payload[1 + LOG_RECORD_MAX];
+    uint8_t frame[1 + FRAME_MAX(sizeof(payload))];
+    int len, n;
+
+    if (log_buffer->size == 0)
+        return;
+
+    payload[0] = TLM_LOG;
+    frame[0] = FRAME_DELIM;
+    while((len = rec_read(log_buffer, payload + 1, LOG_RECORD_MAX)) >= 0) {
+        n = frame_encode(payload, 1 + len, frame + 1);
+        write((char *) frame, 1 + n);
+    }
+}
+
+static int log_port_write(char *p, int len)
+{
+    return uart_port_write(log_port, p, len);
+}
+
+// Send the pending records (thread context)
+void log_flush(void)
+{
+    log_drain(log_port_write);
+}
+
+// Send the pending records on the console with polled I/O, for use from
+// fault handlers
+void log_flush_err(void)
+{
+    log_drain(uart_write_err);
+}
+
+// Number of records dropped because the ring was full
+uint32_t log_drops(void)
+{
+    return rec_drops(log_buffer);
+}
+
+// Select the UART for log output (already initialized)
+void log_init(int port)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    log_port = port;
+    __disable_irq();
+    log_setup();
+    __set_PRIMASK(primask);
+}
@@ -4,32 +4,147 @@
 //  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
 //
 
-#include <freedom.h>
-#include "common.h"
+#include <string.h>
+#include "ring.h"
 
-inline void buf_reset(RingBuffer *buf, int size)
+// Compiler barrier:  no memory accesses are moved across it
+#define barrier()               asm volatile ("" ::: "memory")
+
+// Read an index owned by the other side exactly once, and publish our own
+// only after all preceding data accesses
+#define LOAD_INDEX(i)           (*(volatile const uint16_t *) &(i))
+#define PUBLISH_INDEX(i, val)   do { barrier(); \
+                                    *(volatile uint16_t *) &(i) = (val); } while(0)
+
+// The consumer marks the buffer busy while it is using data at the head,
+// so that an overwriting producer leaves the head alone (see buf_write())
+#define buf_hold(buf)           do { *(volatile uint8_t *) &(buf)->busy = 1; \
+                                    barrier(); } while(0)
+#define buf_release(buf)        do { barrier(); \
+                                    *(volatile uint8_t *) &(buf)->busy = 0; } while(0)
+
+#ifdef __arm__
+// Mask interrupts, returning the previous state
+static inline uint32_t irq_save(void)
 {
-    buf->head = buf->tail = 0;
-    buf->size = size;
+    uint32_t primask;
+    asm volatile ("mrs %0, primask\n\tcpsid i" : "=r" (primask) :: "memory");
+    return primask;
+}
+
+static inline void irq_restore(uint32_t primask)
+{
+    asm volatile ("msr primask, %0" :: "r" (primask) : "memory");
+}
+#else
+// Host builds (tests and benchmarks) are single threaded
+static inline uint32_t irq_save(void)           { return 0; }
+static inline void irq_restore(uint32_t primask) { }
+#endif
+
+#if RING_POW2
+
+// Map a free-running counter to an index into the data array
+static inline uint16_t buf_index(const RingBuffer *buf, uint16_t i)
+{
+    return i & (buf->size - 1);
+}
+
+// Move counter i forward by n bytes
+static inline uint16_t buf_advance(uint16_t i, int n, uint16_t size)
+{
+    return i + n;
+}
+
+// Usable bytes in an empty buffer
+static inline int buf_capacity(const RingBuffer *buf)
+{
+    return buf->size;
+}
+
+inline int buf_len(const RingBuffer *buf)
+{
+    return (uint16_t)(LOAD_INDEX(buf->tail) - LOAD_INDEX(buf->head));
+}
+
+// (The head is read before claimed, see buf_claim())
+inline int buf_space(const RingBuffer *buf)
+{
+    const int len = buf_len(buf);
+    return buf->size - len - LOAD_INDEX(buf->claimed);
+}
+
+inline int buf_isfull(const RingBuffer *buf)
+{
+    return buf_space(buf) == 0;
+}
+
+inline int buf_isempty(const RingBuffer *buf)
+{
+    return LOAD_INDEX(buf->head) == LOAD_INDEX(buf->tail);
+}
+
+inline uint8_t buf_get_byte(RingBuffer *buf)
+{
+    buf_hold(buf);
+    const uint16_t head = buf->head;
+    const uint8_t item = buf->data[buf_index(buf, head)];
+    PUBLISH_INDEX(buf->head, head + 1);
+    buf_release(buf);
+    return item;
+}
+
+inline void buf_put_byte(RingBuffer *buf, uint8_t val)
+{
+    const uint16_t tail = buf->tail;
+    buf->data[buf_index(buf, tail)] = val;
+    PUBLISH_INDEX(buf->tail, tail + 1);
+}
+
+#else
+
+static inline uint16_t buf_index(const RingBuffer *buf, uint16_t i)
+{
+    return i;
+}
+
+// Move index i forward by n bytes (n <= size)
+static inline uint16_t buf_advance(uint16_t i, int n, uint16_t size)
+{
+    i += n;
+    if (i >= size)
+        i -= size;
+    return i;
+}
+
+static inline int buf_capacity(const RingBuffer *buf)
+{
+    return buf->size - 1;
 }
 
 inline int buf_len(const RingBuffer *buf)
 {
-    int len = buf->tail - buf->head;
+    int len = LOAD_INDEX(buf->tail) - LOAD_INDEX(buf->head);
     if (len < 0)
         len += buf->size;
     
     return len;
 }
 
+inline int buf_space(const RingBuffer *buf)
+{
+    const int len = buf_len(buf);
+    return buf->size - 1 - len - LOAD_INDEX(buf->claimed);
+}
+
 inline int buf_isfull(const RingBuffer *buf)
 {
-    return buf_len(buf) == (buf->size-1);
+    return buf_space(buf) == 0;
 }
 
 inline int buf_isempty(const RingBuffer *buf)
 {
-    return buf->head == buf->tail;
+    return LOAD_INDEX(buf->head) == LOAD_INDEX(buf->tail);
 }
 
 inline int advance(uint16_t i, uint16_t size)
@@ -42,13 +157,384 @@ inline int advance(uint16_t i, uint16_t size)
 
 inline uint8_t buf_get_byte(RingBuffer *buf)
 {
-    const uint8_t item = buf->data[buf->head];
-    buf->head = advance(buf->head, buf->size);
+    buf_hold(buf);
+    const uint16_t head = buf->head;
+    const uint8_t item = buf->data[head];
+    PUBLISH_INDEX(buf->head, advance(head, buf->size));
+    buf_release(buf);
     return item;
 }
 
 inline void buf_put_byte(RingBuffer *buf, uint8_t val)
 {
-    buf->data[buf->tail] = val;
-    buf->tail = advance(buf->tail, buf->size);
+    const uint16_t tail = buf->tail;
+    buf->data[tail] = val;
+    PUBLISH_INDEX(buf->tail, advance(tail, buf->size));
+}
+
+#endif
+
+inline void buf_reset(RingBuffer *buf, int size)
+{
+#if RING_POW2
+    while (size & (size - 1))           // Round down to a power of two
+        size &= size - 1;
+#endif
+
+    buf->head = buf->tail = buf->claimed = 0;
+    buf->size = size;
+    buf->flags = buf->busy = 0;
+    buf->drops = buf->rec_drops = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Overwrite mode
+//
+// When full, buf_write() and rec_reserve() discard the oldest data to make
+// room instead of refusing the new data.  The producer moves the head with
+// interrupts masked, and only while the consumer isn't using the data there;
+// if it is, the new data is discarded instead.  Either way, the losses are
+// added to the drop counters.
+//
+// Claimed bytes (see buf_claim()) stay put, so buf_write() discards the
+// bytes after them by moving the rest of the data down over them and
+// pulling the tail back.  Records don't support claims.
+//
+
+void buf_set_overwrite(RingBuffer *buf, int enable)
+{
+    if (enable)
+        buf->flags |= BUF_OVERWRITE;
+    else
+        buf->flags &= ~BUF_OVERWRITE;
+}
+
+// Bytes discarded in overwrite mode (record payload bytes, for records)
+uint32_t buf_drops(const RingBuffer *buf)
+{
+    return buf->drops;
+}
+
+// Records discarded in overwrite mode
+uint32_t rec_drops(const RingBuffer *buf)
+{
+    return buf->rec_drops;
+}
+
+// Discard the oldest bytes until len bytes are free.  Returns free bytes.
+static int buf_make_room(RingBuffer *buf, int len)
+{
+    const uint32_t primask = irq_save();
+    int space = buf_space(buf);
+    int n = len - space, keep;
+    uint16_t from, to;
+
+    if (n > 0 && !buf->busy) {
+        if (n > buf_len(buf))
+            n = buf_len(buf);
+        if (buf->claimed) {
+            keep = buf_len(buf) - n;
+            to = buf->head;
+            from = buf_advance(to, n, buf->size);
+            while (keep-- > 0) {
+                buf->data[buf_index(buf, to)] = buf->data[buf_index(buf, from)];
+                to = buf_advance(to, 1, buf->size);
+                from = buf_advance(from, 1, buf->size);
+            }
+            buf->tail = to;
+        } else
+            buf->head = buf_advance(buf->head, n, buf->size);
+        buf->drops += n;
+        space += n;
+    }
+    irq_restore(primask);
+    return space;
+}
+
+// ---------------------------------------------------------------------------
+// Span access
+//
+// Any run of bytes in the buffer (the free space after the tail, or the
+// contents after the head) is at most two contiguous regions:  one up to
+// the end of the data array, and one that wraps around to the start.
+//
+
+// Describe len bytes starting at index start as (up to) two spans
+static int buf_spans(RingBuffer *buf, int start, int len, BufSpan span[2])
+{
+    int first = buf->size - start;
+    if (first > len)
+        first = len;
+
+    span[0].data = &buf->data[start];
+    span[0].len  = first;
+    span[1].data = &buf->data[0];
+    span[1].len  = len - first;
+
+    barrier();          // Don't touch the data before the index was read
+    return len;
+}
+
+// Get the free space as spans to fill in place.  Returns total free bytes.
+int buf_reserve(RingBuffer *buf, BufSpan span[2])
+{
+    return buf_spans(buf, buf_index(buf, buf->tail), buf_space(buf), span);
+}
+
+// Add len bytes, previously written into the reserved spans, to the buffer
+void buf_commit(RingBuffer *buf, int len)
+{
+    PUBLISH_INDEX(buf->tail, buf_advance(buf->tail, len, buf->size));
+}
+
+// Add len bytes written after the tail by a producer that doesn't wait for
+// room (e.g. circular DMA), and so may have written over the oldest data:
+// those bytes are discarded, and counted as drops.  len may be more than
+// the whole buffer, leaving just the newest bytes.  The consumer must not
+// be between buf_peek() and buf_consume() meanwhile (it can mask interrupts
+// while it reads).
+void buf_commit_over(RingBuffer *buf, int len)
+{
+    const uint32_t primask = irq_save();
+    int n, lost;
+
+    while (len > 2 * buf->size) {               // (Full by the second lap)
+        buf->drops += buf->size;
+        len -= buf->size;
+    }
+    for (; len > 0; len -= n) {
+        n = len < buf->size ? len : buf->size;
+        lost = n - buf_space(buf);
+        if (lost > 0) {
+            buf->head = buf_advance(buf->head, lost, buf->size);
+            buf->drops += lost;
+        }
+        PUBLISH_INDEX(buf->tail, buf_advance(buf->tail, n, buf->size));
+    }
+    irq_restore(primask);
+}
+
+// Get the buffer contents as spans.  Returns total bytes available.  If
+// not empty, the data must be released with buf_consume() (even if 0 bytes).
+int buf_peek(RingBuffer *buf, BufSpan span[2])
+{
+    int len;
+
+    buf_hold(buf);
+    len = buf_spans(buf, buf_index(buf, buf->head), buf_len(buf), span);
+    if (len == 0)
+        buf_release(buf);
+    return len;
+}
+
+// Remove len bytes, previously read from the peeked spans, from the buffer
+void buf_consume(RingBuffer *buf, int len)
+{
+    PUBLISH_INDEX(buf->head, buf_advance(buf->head, len, buf->size));
+    buf_release(buf);
+}
+
+// Remove len bytes, previously read from the peeked spans, from the buffer,
+// but leave their space claimed:  the consumer can go on using them in place
+// (e.g. by DMA) until buf_unclaim().  claimed is set before the head moves,
+// so the producer never sees the space as free.
+void buf_claim(RingBuffer *buf, int len)
+{
+    PUBLISH_INDEX(buf->claimed, buf->claimed + len);
+    buf_consume(buf, len);
+}
+
+// Free the space of len claimed bytes (the oldest)
+void buf_unclaim(RingBuffer *buf, int len)
+{
+    PUBLISH_INDEX(buf->claimed, buf->claimed - len);
+}
+
+// Copy up to len bytes into the buffer.  Returns number of bytes written.
+int buf_write(RingBuffer *buf, const uint8_t *p, int len)
+{
+    BufSpan span[2];
+    int n;
+
+    if (buf->flags & BUF_OVERWRITE) {
+        n = len - (buf_capacity(buf) - LOAD_INDEX(buf->claimed));
+        if (n > 0) {                            // Only the last part fits
+            buf->drops += n;
+            p += n;
+            len -= n;
+        }
+        n = buf_make_room(buf, len);
+        if (len > n) {                          // Consumer busy, drop new data
+            buf->drops += len - n;
+            len = n;
+        }
+    }
+
+    n = buf_reserve(buf, span);
+
+    if (len > n)
+        len = n;
+    n = len < span[0].len ? len : span[0].len;
+    memcpy(span[0].data, p, n);
+    memcpy(span[1].data, p + n, len - n);
+
+    buf_commit(buf, len);
+    return len;
+}
+
+// Copy up to len bytes out of the buffer.  Returns number of bytes read.
+int buf_read(RingBuffer *buf, uint8_t *p, int len)
+{
+    BufSpan span[2];
+    int n = buf_peek(buf, span);
+
+    if (len > n)
+        len = n;
+    n = len < span[0].len ? len : span[0].len;
+    memcpy(p, span[0].data, n);
+    memcpy(p + n, span[1].data, len - n);
+
+    buf_consume(buf, len);
+    return len;
+}
+
+// ---------------------------------------------------------------------------
+// Records
+//
+// Variable-length records, each stored as a 32-bit length word followed by
+// the payload and padded to a multiple of 4 bytes.  A record is never split
+// across the end of the buffer:  if it doesn't fit before the end, a pad
+// marker fills the gap and the record starts at the beginning.  This keeps
+// every payload contiguous and 4-byte aligned, so it can be used in place.
+//
+// The buffer size must be a multiple of 4.  Records are added and removed
+// whole, with the same producer/consumer ownership as the byte operations.
+// Records up to half the buffer size are always accepted once it drains.
+//
+
+#define REC_HDR         4
+#define REC_PAD         0xffffffff
+#define rec_size(len)   ((REC_HDR + (len) + 3) & ~3)
+
+static inline uint32_t *rec_hdr(RingBuffer *buf, uint16_t i)
+{
+    return (uint32_t *) &buf->data[buf_index(buf, i)];
+}
+
+// Overwrite mode:  discard the oldest records until len bytes are free
+static void rec_make_room(RingBuffer *buf, int len)
+{
+    const uint32_t primask = irq_save();
+    uint32_t n;
+
+    while (!buf->busy && buf_space(buf) < len && !buf_isempty(buf)) {
+        n = *rec_hdr(buf, buf->head);
+        if (n == REC_PAD) {
+            n = buf->size - buf_index(buf, buf->head);
+        } else {
+            buf->drops += n;
+            buf->rec_drops++;
+            n = rec_size(n);
+        }
+        buf->head = buf_advance(buf->head, n, buf->size);
+    }
+    irq_restore(primask);
+}
+
+// Reserve space for a len byte record.  Returns a pointer to fill in, or
+// NULL if the record doesn't fit (nothing is added).
+uint8_t *rec_reserve(RingBuffer *buf, int len)
+{
+    const uint16_t tail = buf->tail;
+    const int to_end = buf->size - buf_index(buf, tail);
+    const int need = rec_size(len);
+    const int room = need <= to_end ? need : to_end + need;
+
+    if (room > buf_space(buf) && (buf->flags & BUF_OVERWRITE)
+                              && room <= buf_capacity(buf))
+        rec_make_room(buf, room);
+
+    if (room > buf_space(buf)) {
+        if (buf->flags & BUF_OVERWRITE) {
+            buf->drops += len;
+            buf->rec_drops++;
+        }
+        return NULL;
+    }
+
+    barrier();
+    if (need > to_end) {
+        // Skip to the start of the buffer
+        *rec_hdr(buf, tail) = REC_PAD;
+        PUBLISH_INDEX(buf->tail, buf_advance(tail, to_end, buf->size));
+    }
+    return (uint8_t *) (rec_hdr(buf, buf->tail) + 1);
+}
+
+// Add a reserved record, with its final length (<= the reserved length)
+void rec_commit(RingBuffer *buf, int len)
+{
+    *rec_hdr(buf, buf->tail) = len;
+    PUBLISH_INDEX(buf->tail, buf_advance(buf->tail, rec_size(len), buf->size));
+}
+
+// Get the next record in place, and its length.  Returns NULL if empty.
+uint8_t *rec_peek(RingBuffer *buf, int *len)
+{
+    uint32_t *hdr;
+
+    buf_hold(buf);
+    for(;;) {
+        if (buf_isempty(buf)) {
+            buf_release(buf);
+            return NULL;
+        }
+
+        barrier();
+        hdr = rec_hdr(buf, buf->head);
+        if (*hdr != REC_PAD)
+            break;
+
+        PUBLISH_INDEX(buf->head, buf_advance(buf->head, 
+                        buf->size - buf_index(buf, buf->head), buf->size));
+    }
+
+    *len = *hdr;
+    return (uint8_t *) (hdr + 1);
+}
+
+// Remove the record returned by rec_peek()
+void rec_release(RingBuffer *buf)
+{
+    const int len = *rec_hdr(buf, buf->head);
+    PUBLISH_INDEX(buf->head, buf_advance(buf->head, rec_size(len), buf->size));
+    buf_release(buf);
+}
+
+// Copy in a whole record.  Returns len, or -1 if it doesn't fit.
+int rec_write(RingBuffer *buf, const void *p, int len)
+{
+    uint8_t *rec = rec_reserve(buf, len);
+
+    if (rec == NULL)
+        return -1;
+
+    memcpy(rec, p, len);
+    rec_commit(buf, len);
+    return len;
+}
+
+// Copy out the next record, truncated to maxlen bytes.  Returns the record
+// length, or -1 if empty.
+int rec_read(RingBuffer *buf, void *p, int maxlen)
+{
+    int len;
+    uint8_t *rec = rec_peek(buf, &len);
+
+    if (rec == NULL)
+        return -1;
+
+    memcpy(p, rec, len < maxlen ? len : maxlen);
+    rec_release(buf);
+    return len;
 }
@@ -0,0 +1,83 @@
+//
+// ring.h -- Ring buffer definitions
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <stdint.h>
+
+// Power-of-two ring buffers:  head and tail are free-running 16-bit counters
+// that are masked on access, so every slot can be used and the length, full
+// and empty checks need no branches.  Sizes must be a power of two (<= 32768);
+// buf_reset() rounds other sizes down.
+//
+// Define RING_POW2 as 0 for arbitrary sizes (one slot is left unused).
+#ifndef RING_POW2
+#define RING_POW2 1
+#endif
+
+// A RingBuffer is a lock-free single-producer/single-consumer queue.  The
+// producer (buf_put_byte, buf_reserve/commit, buf_write) owns the tail and
+// the consumer (buf_get_byte, buf_peek/consume, buf_read) owns the head, so
+// each side can be in a different context (e.g. an ISR and main()).
+//
+// Each side reads the other's index once per call, and publishes its own
+// index only after a compiler barrier:  the producer's data stores complete
+// before the tail moves, and the consumer's data loads complete before the
+// head moves.  The Cortex-M0+ is single core and in order, so no hardware
+// barrier is needed.
+//
+// In overwrite mode (buf_set_overwrite()), a full buffer discards its oldest
+// data rather than refusing new data, and counts the losses.
+//
+// A consumer that goes on using data in place after taking it (e.g. a DMA
+// transfer out of the buffer) claims it with buf_claim() rather than
+// buf_consume():  its space isn't reused until buf_unclaim(), and meanwhile
+// overwrite mode discards the oldest bytes after it instead.
+typedef struct {
+    uint16_t head;              // Owned by the consumer
+    uint16_t tail;              // Owned by the producer
+    uint16_t size;
+    uint8_t flags;
+    uint8_t busy;               // Consumer is using data at the head
+    uint16_t claimed;           // Bytes before the head still in use (consumer)
+    uint32_t drops;             // Bytes discarded (producer)
+    uint32_t rec_drops;         // Records discarded (producer)
+    uint8_t data[] __attribute__ ((aligned(4)));
+} RingBuffer;
+
+#define BUF_OVERWRITE   0x01    // flags:  overwrite oldest data when full
+
+// A contiguous region of a ring buffer's data
+typedef struct {
+    uint8_t *data;
+    int len;
+} BufSpan;
+
+void buf_reset(RingBuffer *buf, int size);
+int buf_len(const RingBuffer *buf);
+int buf_space(const RingBuffer *buf);
+int buf_isfull(const RingBuffer *buf);
+int buf_isempty(const RingBuffer *buf);
+uint8_t buf_get_byte(RingBuffer *buf);
+void buf_put_byte(RingBuffer *buf, uint8_t val);
+int buf_reserve(RingBuffer *buf, BufSpan span[2]);
+void buf_commit(RingBuffer *buf, int len);
+void buf_commit_over(RingBuffer *buf, int len);
+int buf_peek(RingBuffer *buf, BufSpan span[2]);
+void buf_consume(RingBuffer *buf, int len);
+void buf_claim(RingBuffer *buf, int len);
+void buf_unclaim(RingBuffer *buf, int len);
+int buf_write(RingBuffer *buf, const uint8_t *p, int len);
+int buf_read(RingBuffer *buf, uint8_t *p, int len);
+void buf_set_overwrite(RingBuffer *buf, int enable);
+uint32_t buf_drops(const RingBuffer *buf);
+uint32_t rec_drops(const RingBuffer *buf);
+
+// Variable-length records (see ring.c)
+uint8_t *rec_reserve(RingBuffer *buf, int len);
+void rec_commit(RingBuffer *buf, int len);
+uint8_t *rec_peek(RingBuffer *buf, int *len);
+void rec_release(RingBuffer *buf);
+int rec_write(RingBuffer *buf, const void *p, int len);
+int rec_read(RingBuffer *buf, void *p, int maxlen);
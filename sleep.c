@@ -0,0 +1,135 @@
+//
+// sleep.c -- Sleeping while waiting
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <freedom.h>
+#include "common.h"
+
+// Sleeping is tickless:  the timer tick is held off until the next timer
+// due (see timer_idle()), so an idle board wakes only for real work.  If
+// nothing needs the fast clocks (see sleep_lock()) and the next timer is far
+// enough off, the core goes into STOP mode and the LPTMR, running from the
+// crystal, times the sleep.
+#define SLEEP_TICKS_MAX     (60 * TIMER_HZ)     // Look ahead at most a minute
+#define STOP_TICKS_MIN      (10 * TIMER_HZ / 1000)  // 10ms:  worth the PLL relock
+#define STOP_PRESCALE       64                  // LPTMR count is XTAL_CLOCK / 64
+#define STOP_COUNT_CYCLES   (BUS_CLOCK / (XTAL_CLOCK / STOP_PRESCALE))
+#define STOP_CYCLES_MAX     (0xffffUL * STOP_COUNT_CYCLES)
+
+static uint64_t asleep;                 // Time spent asleep, in core clock cycles
+static uint32_t wakeups, stops;
+static volatile int locks;              // Reasons not to use STOP
+
+// Waiting can sleep only in thread mode with interrupts enabled:  in a
+// handler or with interrupts disabled, the wakeup might never be serviced
+int sleep_allowed(void)
+{
+    return __get_IPSR() == 0 && __get_PRIMASK() == 0;
+}
+
+//
+// sleep_lock() -- Keep sleeps out of STOP mode, until sleep_unlock()
+//
+//      STOP halts the core, bus and PLL clocks, and so everything that runs
+//      from them (UARTs, DMA, I2C, ...).  Locks nest.
+//
+void sleep_lock(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    locks++;
+    __set_PRIMASK(primask);
+}
+
+void sleep_unlock(void)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    locks--;
+    __set_PRIMASK(primask);
+}
+
+// Sleep in STOP mode for at most cycles (of the bus clock), using the LPTMR
+// from the crystal to wake up and to measure the time.  Returns bus cycles.
+static uint32_t stop(uint32_t cycles)
+{
+    uint32_t count;
+
+    // Keep the crystal running in STOP, for the LPTMR
+    OSC0_CR |= OSC_CR_ERCLKEN_MASK | OSC_CR_EREFSTEN_MASK;
+    SIM_SCGC5 |= SIM_SCGC5_LPTMR_MASK;
+    LPTMR0_CSR = 0;
+    LPTMR0_PSR = LPTMR_PSR_PCS(3) | LPTMR_PSR_PRESCALE(5);     // OSCERCLK / 64
+    LPTMR0_CMR = cycles / STOP_COUNT_CYCLES;
+    LPTMR0_CSR = LPTMR_CSR_TEN_MASK | LPTMR_CSR_TIE_MASK | LPTMR_CSR_TFC_MASK;
+    enable_irq(INT_LPTimer);
+
+    SMC_PMCTRL = SMC_PMCTRL_STOPM(0);   // Normal STOP
+    (void) SMC_PMCTRL;                  // (Make sure the write is done)
+    SCB_SCR |= SCB_SCR_SLEEPDEEP_MASK;
+    __WFI();
+    SCB_SCR &= ~SCB_SCR_SLEEPDEEP_MASK;
+
+    // The MCG comes out of STOP in PLL bypass:  wait for the PLL to lock and
+    // switch back to it
+    while (!(MCG_S & MCG_S_LOCK0_MASK))
+        ;
+    MCG_C1 &= ~MCG_C1_CLKS_MASK;
+    while ((MCG_S & MCG_S_CLKST_MASK) != MCG_S_CLKST(3))
+        ;
+
+    LPTMR0_CNR = 0;                     // Latch the count, to read it
+    count = LPTMR0_CNR;
+    LPTMR0_CSR = 0;
+    NVIC_ICPR = 1 << (INT_LPTimer - 16);
+    return count * STOP_COUNT_CYCLES;
+}
+
+//
+// sleep_wait() -- Sleep until an interrupt, and service it
+//
+//      Called by SLEEP_UNTIL() with interrupts disabled, after checking its
+//      condition.  WFI still wakes for a pending interrupt, so one arriving
+//      after the check isn't missed.
+//
+void sleep_wait(void)
+{
+    uint64_t start = clock_cycles();
+    uint32_t cycles = timer_next(SLEEP_TICKS_MAX), slept;
+
+    if (locks == 0 && cycles >= STOP_TICKS_MIN * (BUS_CLOCK / TIMER_HZ)) {
+        timer_idle(1);
+        slept = timer_resume(stop(cycles < STOP_CYCLES_MAX ? cycles : STOP_CYCLES_MAX));
+        stops++;
+    } else {
+        timer_idle(0);
+        __WFI();
+        slept = timer_resume(0);
+    }
+    clock_adjust(start, slept * (CORE_CLOCK / BUS_CLOCK));
+    asleep += clock_cycles() - start;
+    wakeups++;
+
+    __enable_irq();                     // Run the interrupt handler
+    __disable_irq();
+}
+
+// Microseconds spent asleep since boot
+uint64_t sleep_us(void)
+{
+    uint32_t primask = __get_PRIMASK();
+    uint64_t cycles;
+
+    __disable_irq();
+    cycles = asleep;
+    __set_PRIMASK(primask);
+    return cycles / CLOCK_CYCLES_PER_US;
+}
+
+// Number of sleeps, and of those in STOP mode, since boot
+uint32_t sleep_wakeups(void)            { return wakeups; }
+uint32_t sleep_stops(void)              { return stops; }
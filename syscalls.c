@@ -7,6 +7,9 @@
 
 #include <freedom.h>
 #include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdarg.h>
 #include "common.h"
 
 int _close(int file) { return -1; }
@@ -19,10 +22,57 @@ int _fstat(int file, struct stat *st)
     return 0;       
 }
 
+// File status flags for stdin/stdout/stderr, set with fcntl(F_SETFL).  With
+// O_NONBLOCK, reads and writes return what they could transfer immediately,
+// or fail with EAGAIN if that was nothing.
+#define NFILES 3
+static int file_flags[NFILES];
+
+int _fcntl(int file, int cmd, int arg)
+{
+    if (file < 0 || file >= NFILES) {
+        errno = EBADF;
+        return -1;
+    }
+    switch(cmd) {
+     case F_GETFL:  return file_flags[file];
+     case F_SETFL:  file_flags[file] = arg & O_NONBLOCK;
+                    return 0;
+     default:       errno = EINVAL;
+                    return -1;
+    }
+}
+
+// newlib's fcntl() only calls _fcntl() where it's configured with
+// HAVE_FCNTL (otherwise it fails with ENOSYS), and arm-none-eabi isn't
+int fcntl(int file, int cmd, ...)
+{
+    va_list ap;
+    int arg;
+
+    va_start(ap, cmd);
+    arg = va_arg(ap, int);
+    va_end(ap);
+    return _fcntl(file, cmd, arg);
+}
+
+// Result of a non-blocking transfer of n of len bytes:  the byte count, or
+// EAGAIN if none could be transferred
+static int nonblock_result(int n, int len)
+{
+    if (n > 0 || len == 0)
+        return n;
+    errno = EAGAIN;
+    return -1;
+}
+
 int _write(int file, char *p, int len)
 {
     switch(file) {
-     case 1:        return uart_write(p, len);              // stdout
+     case 1:                                                // stdout
+        if (file_flags[file] & O_NONBLOCK)
+            return nonblock_result(uart_try_write(p, len), len);
+        return uart_write(p, len);
      case 2:        return uart_write_err(p,len);           // stderr
      default:       return -1;
     }
@@ -30,6 +80,8 @@ int _write(int file, char *p, int len)
 
 int _read(int file, char *p, int len)
 {
+    if (file == 0 && (file_flags[file] & O_NONBLOCK))
+        return nonblock_result(uart_try_read(p, len), len);
     return uart_read(p, len);
 }
 
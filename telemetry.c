@@ -0,0 +1,84 @@
+//
+// telemetry.c -- Binary telemetry over a UART
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <freedom.h>
+#include "common.h"
+
+// Records are collected in a frame payload and sent when the next one
+// doesn't fit, or on tlm_flush().  Not reentrant:  call from one context.
+static uint8_t payload[TLM_PAYLOAD_MAX];
+static int payload_len;
+static int tlm_port;
+
+static const uint8_t sizes[TLM_TYPES] = TLM_SIZES;
+
+// Send the records collected so far as one frame.  A delimiter is sent
+// first as well, so console text on the same port only costs the decoder
+// that text, and not the frame after it.
+void tlm_flush(void)
+{
+    uint8_t frame[1 + FRAME_MAX(TLM_PAYLOAD_MAX)];
+
+    if (payload_len == 0)
+        return;
+    frame[0] = FRAME_DELIM;
+    uart_port_write(tlm_port, (char *) frame, 
+                        1 + frame_encode(payload, payload_len, frame + 1));
+    payload_len = 0;
+}
+
+// Start a record of the given type, and return where its body goes
+static uint8_t *tlm_record(int type)
+{
+    uint8_t *p;
+
+    if (payload_len + 1 + sizes[type] > TLM_PAYLOAD_MAX)
+        tlm_flush();
+    p = &payload[payload_len];
+    payload_len += 1 + sizes[type];
+    *p++ = type;
+    return p;
+}
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+    *p++ = v;
+    *p++ = v >> 8;
+    return p;
+}
+
+void tlm_time(uint32_t t)
+{
+    uint8_t *p = tlm_record(TLM_TIME);
+
+    p = put16(p, t);
+    put16(p, t >> 16);
+}
+
+void tlm_accel(int16_t x, int16_t y, int16_t z)
+{
+    uint8_t *p = tlm_record(TLM_ACCEL);
+
+    p = put16(p, x);
+    p = put16(p, y);
+    put16(p, z);
+}
+
+void tlm_touch(int channel, uint16_t count)
+{
+    uint8_t *p = tlm_record(TLM_TOUCH);
+
+    *p++ = channel;
+    put16(p, count);
+}
+
+// Select the UART for telemetry (already initialized), and discard any
+// unsent records
+void tlm_init(int port)
+{
+    tlm_port = port;
+    payload_len = 0;
+}
@@ -0,0 +1,19 @@
+//
+// telemetry.h -- Telemetry record formats
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+// Telemetry is sent as COBS frames (see cobs.h).  Each frame payload holds
+// one or more records:  a type byte, then a fixed size body of little
+// endian fields.
+#define TLM_TIME        1           // uint32 timestamp
+#define TLM_ACCEL       2           // int16 x, y, z
+#define TLM_TOUCH       3           // uint8 channel, uint16 count
+#define TLM_LOG         4           // uint32 format ID, uint32 args (log.c)
+
+// Body sizes, indexed by type (0 = the rest of the frame)
+#define TLM_SIZES       { 0, 4, 6, 3, 0 }
+#define TLM_TYPES       5
+
+#define TLM_PAYLOAD_MAX 64          // Records are batched up to this size
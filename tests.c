@@ -7,6 +7,10 @@
 #include <freedom.h>
 #include "common.h"
 #include <assert.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
 
 extern char *_sbrk(int len);
 
@@ -14,6 +18,297 @@ static volatile uint32_t init_zero;
 static volatile uint32_t init_value = 0xdeadbeef;
 static const uint32_t const_value = 0x12345678;
 
+// Ring buffer span operations
+static void ring_tests(void)
+{
+    static uint8_t _buf[sizeof(RingBuffer) + 8] __attribute__ ((aligned(4)));
+    RingBuffer *const buf = (RingBuffer *) &_buf;
+    const int cap = RING_POW2 ? 8 : 7;          // Usable bytes
+    BufSpan span[2];
+    uint8_t out[8];
+
+    buf_reset(buf, 8);
+    assert(buf_space(buf) == cap);
+    assert(buf_write(buf, (uint8_t *) "abcde", 5) == 5);
+    assert(buf_read(buf, out, 3) == 3);
+    assert(memcmp(out, "abc", 3) == 0);
+
+    // Free space now wraps around the end of the buffer
+    assert(buf_reserve(buf, span) == cap - 2);
+    assert(span[0].len == 3 && span[1].len == cap - 5);
+    assert(buf_write(buf, (uint8_t *) "fghijklm", 8) == cap - 2);
+    assert(buf_isfull(buf));
+
+    assert(buf_peek(buf, span) == cap);
+    assert(span[0].len == 5 && span[1].len == cap - 5);
+    assert(buf_read(buf, out, sizeof(out)) == cap);
+    assert(memcmp(out, "defghijk", cap) == 0);
+    assert(buf_isempty(buf));
+}
+
+// Variable-length records
+static void record_tests(void)
+{
+    static uint8_t _buf[sizeof(RingBuffer) + 32] __attribute__ ((aligned(4)));
+    RingBuffer *const buf = (RingBuffer *) &_buf;
+    uint8_t out[16], *rec;
+    int len;
+
+    buf_reset(buf, 32);
+    assert(rec_peek(buf, &len) == NULL);
+    assert(rec_write(buf, "hello", 5) == 5);                // 12 bytes used
+    assert(rec_write(buf, "0123456789", 10) == 10);         // 28 bytes used
+    assert(rec_write(buf, "xyz", 3) == -1);                 // Rejected whole
+
+    rec = rec_peek(buf, &len);
+    assert(rec != NULL && len == 5);
+    assert(memcmp(rec, "hello", 5) == 0);
+    rec_release(buf);
+
+    // Doesn't fit before the end of the buffer, so it goes at the start
+    assert(rec_write(buf, "abcd", 4) == 4);
+    assert(rec_read(buf, out, sizeof(out)) == 10);
+    assert(memcmp(out, "0123456789", 10) == 0);
+    rec = rec_peek(buf, &len);
+    assert(rec == buf->data + 4 && len == 4);
+    assert(memcmp(rec, "abcd", 4) == 0);
+    rec_release(buf);
+    assert(rec_peek(buf, &len) == NULL);
+}
+
+// Overwrite mode and drop counters
+static void overwrite_tests(void)
+{
+    static uint8_t _buf[sizeof(RingBuffer) + 32] __attribute__ ((aligned(4)));
+    RingBuffer *const buf = (RingBuffer *) &_buf;
+    const int cap = RING_POW2 ? 32 : 31;
+    BufSpan span[2];
+    uint8_t out[32];
+    uint8_t i;
+    int len;
+
+    // The oldest bytes are discarded
+    buf_reset(buf, 32);
+    buf_set_overwrite(buf, 1);
+    for(i=0; i<40; i++)
+        assert(buf_write(buf, &i, 1) == 1);
+    assert(buf_drops(buf) == 40 - cap);
+    assert(buf_read(buf, out, sizeof(out)) == cap);
+    assert(out[0] == 40 - cap && out[cap-1] == 39);
+
+    // ...unless the consumer is using them
+    for(i=0; i<cap; i++)
+        buf_write(buf, &i, 1);
+    assert(buf_peek(buf, span) == cap);
+    assert(buf_write(buf, &i, 1) == 0);
+    assert(buf_drops(buf) == 41 - cap);
+    buf_consume(buf, 1);
+    assert(buf_write(buf, &i, 1) == 1);
+
+    // ...but the bytes after claimed ones are (like transmit DMA's block)
+    buf_reset(buf, 32);
+    buf_set_overwrite(buf, 1);
+    for(i=0; i<cap; i++)
+        buf_write(buf, &i, 1);
+    assert(buf_peek(buf, span) == cap);
+    buf_claim(buf, 8);
+    assert(buf_len(buf) == cap - 8 && buf_isfull(buf));
+    assert(buf_write(buf, (uint8_t *) "wxyz", 4) == 4);
+    assert(buf_drops(buf) == 4);
+    assert(buf->data[0] == 0 && buf->data[7] == 7);         // Claimed, intact
+    assert(buf_read(buf, out, sizeof(out)) == cap - 8);
+    assert(out[0] == 12 && out[cap - 13] == cap - 1);
+    assert(memcmp(out + cap - 12, "wxyz", 4) == 0);
+    assert(buf_space(buf) == cap - 8);
+    buf_unclaim(buf, 8);
+    assert(buf_space(buf) == cap);
+
+    // A circular writer that laps the consumer (like receive DMA) leaves
+    // just the newest bytes
+    buf_reset(buf, 32);
+    for(i=0; i<20; i++)
+        buf->data[i] = i;
+    buf_commit_over(buf, 20);
+    assert(buf_len(buf) == 20 && buf_drops(buf) == 0);
+    for(i=20; i<100; i++)
+        buf->data[i % 32] = i;
+    buf_commit_over(buf, 80);
+    assert(buf_len(buf) == cap && buf_drops(buf) == 100 - cap);
+    assert(buf_read(buf, out, sizeof(out)) == cap);
+    assert(out[0] == 100 - cap && out[cap-1] == 99);
+
+    // Whole records are discarded
+    buf_reset(buf, 32);
+    buf_set_overwrite(buf, 1);
+    rec_write(buf, "aaaa", 4);
+    rec_write(buf, "bbbb", 4);
+    rec_write(buf, "cccc", 4);
+    assert(rec_write(buf, "dddddddd", 8) == 8);
+    assert(rec_drops(buf) == 2 && buf_drops(buf) == 8);
+    assert(rec_read(buf, out, sizeof(out)) == 4 && out[0] == 'c');
+    assert(rec_read(buf, out, sizeof(out)) == 8 && out[0] == 'd');
+    assert(rec_peek(buf, &len) == NULL);
+}
+
+// Non-blocking console input (see _fcntl())
+static void fcntl_tests(void)
+{
+    char c;
+    int flags = fcntl(0, F_GETFL);
+
+    assert(flags >= 0 && !(flags & O_NONBLOCK));
+    assert(fcntl(0, F_SETFL, flags | O_NONBLOCK) == 0);
+    assert(fcntl(0, F_GETFL) & O_NONBLOCK);
+    while (read(0, &c, 1) == 1)                 // (Anything already typed)
+        ;
+    errno = 0;
+    assert(read(0, &c, 1) == -1 && errno == EAGAIN);
+
+    assert(fcntl(0, F_SETFL, flags) == 0);
+    assert(!(fcntl(0, F_GETFL) & O_NONBLOCK));
+}
+
+// Monotonic clock
+static void clock_tests(void)
+{
+    uint64_t t0, t1, c0, c1;
+    int i;
+
+    // Never goes backwards, in either unit
+    t0 = clock_us();
+    c0 = clock_cycles();
+    for(i=0; i<1000; i++) {
+        t1 = clock_us();
+        c1 = clock_cycles();
+        assert(t1 >= t0 && c1 > c0);
+        t0 = t1;
+        c0 = c1;
+    }
+
+    // Agrees with the LPTMR delay (1kHz LPO, so only roughly)
+    t0 = clock_us();
+    delay(10);
+    t1 = clock_us() - t0;
+    assert(t1 > 8000 && t1 < 13000);
+
+    // Busy-waits are exact, to within the loop and call overhead
+    c0 = clock_cycles();
+    delay_us(100);
+    c1 = clock_cycles() - c0;
+    assert(c1 >= 100 * CLOCK_CYCLES_PER_US && c1 < 100 * CLOCK_CYCLES_PER_US + 200);
+    c0 = clock_cycles();
+    delay_cycles(10);
+    c1 = clock_cycles() - c0;
+    assert(c1 >= 10 && c1 < 210);
+}
+
+// Software timers
+static void timer_fired(Timer *t)
+{
+    (*(int *) t->arg)++;
+}
+
+static void timer_tests(void)
+{
+    static Timer t1, t2;
+    volatile int n1 = 0, n2 = 0;
+    uint32_t wakeups;
+    uint64_t t0;
+
+    timer_start(&t1, 2, timer_fired, (void *) &n1);
+    timer_start(&t2, 3, timer_fired, (void *) &n2);
+    assert(timer_pending(&t1) && timer_pending(&t2));
+    timer_cancel(&t2);
+    assert(!timer_pending(&t2));
+
+    delay(10);
+    assert(n1 == 1 && !timer_pending(&t1));
+    assert(n2 == 0);
+
+    // Sleeping is tickless:  waiting for a timer takes a few wakeups, not
+    // one per tick, and the clock keeps time through them
+    wakeups = sleep_wakeups();
+    t0 = clock_us();
+    timer_start(&t1, 50, timer_fired, (void *) &n1);
+    SLEEP_UNTIL(n1 == 2);
+    t0 = clock_us() - t0;
+    assert(sleep_wakeups() - wakeups < 10);
+    assert(t0 > 49000 && t0 < 51000);
+}
+
+// I2C transfers, with the accelerometer (initialized by accel_init())
+static void i2c_done(I2cXfer *x)
+{
+    (*(int *) x->arg)++;
+}
+
+static I2cXfer *i2c_order[2];                   // In order of completion
+static volatile int i2c_completed;
+
+static void i2c_ordered(I2cXfer *x)
+{
+    i2c_order[i2c_completed++] = x;
+}
+
+static void i2c_tests(void)
+{
+    static const I2cDev accel = { .bus = 0, .addr = 0x1d };
+    static const I2cDev absent = { .bus = 0, .addr = 0x50 };
+    static uint8_t reg = 0x0d, id, id2;     // MMA8451 WHO_AM_I
+    static I2cXfer x = { .dev = &accel, .tx = &reg, .tx_len = 1, .rx = &id, 
+                            .rx_len = 1, .done = i2c_done };
+    static I2cXfer probe = { .dev = &absent };  // Nothing there
+    static I2cXfer low = { .dev = &accel, .tx = &reg, .tx_len = 1, .rx = &id2,
+                            .rx_len = 1, .done = i2c_ordered };
+    static I2cXfer high = { .dev = &accel, .tx = &reg, .tx_len = 1, .rx = &id2,
+                            .rx_len = 1, .done = i2c_ordered,
+                            .priority = I2C_PRIO_HIGH };
+    volatile int n = 0;
+    uint8_t regs[16];
+    AccelXYZ a;
+    int32_t g2;
+    uint32_t t0;
+
+    // A faster device on the bus gets the rate it's already running at
+    assert(i2c_init(0, 1000000) == 375000);
+
+    // Queued back to back, completing in order from the interrupt
+    x.arg = (void *) &n;
+    i2c_submit(&x);
+    assert(i2c_transfer(&probe) == I2C_NACK);
+    assert(x.status == I2C_OK && n == 1 && id == 0x1a);
+
+    // Queued behind a running transfer, high priority goes ahead of low
+    i2c_completed = 0;
+    i2c_submit(&x);
+    i2c_submit(&low);
+    i2c_submit(&high);
+    SLEEP_UNTIL(i2c_completed == 2);
+    assert(low.status == I2C_OK && high.status == I2C_OK);
+    assert(i2c_order[0] == &high && i2c_order[1] == &low);
+
+    id = 0;
+    assert(i2c_read_regs(&accel, 0x0d, &id, 1) == I2C_OK && id == 0x1a);
+
+    // A long read (received by DMA), with WHO_AM_I in the middle.  At
+    // 375kHz its 173 bits take 461us.
+    memset(regs, 0, sizeof(regs));
+    t0 = clock_us();
+    assert(i2c_read_regs(&accel, 0x00, regs, sizeof(regs)) == I2C_OK);
+    t0 = clock_us() - t0;
+    assert(regs[0x0d] == 0x1a);
+    assert(t0 > 450 && t0 < 700);
+
+    // ...and the last two bytes (received after the DMA block) intact
+    assert(i2c_read_regs(&accel, 0x0e, &id, 1) == I2C_OK && id == regs[0x0e]);
+    assert(i2c_read_regs(&accel, 0x0f, &id, 1) == I2C_OK && id == regs[0x0f]);
+
+    // Burst read of all the axes:  at rest, about 1g (4096) in total
+    assert(accel_read_xyz(&a) == 0);
+    g2 = a.x * a.x + a.y * a.y + a.z * a.z;
+    assert(g2 > 3000 * 3000 && g2 < 5000 * 5000);
+}
+
 // Run some basic test cases to make sure things are set up correctly
 void tests(void)
 {
@@ -43,4 +338,12 @@ void tests(void)
     assert(init_value == 0xdeadbeef);
     assert(const_value != 0);
     assert(const_value == 0x12345678);
+
+    ring_tests();
+    record_tests();
+    overwrite_tests();
+    fcntl_tests();
+    clock_tests();
+    timer_tests();
+    i2c_tests();
 }
\ No newline at end of file
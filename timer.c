@@ -0,0 +1,299 @@
+//
+// timer.c -- Software timers (hierarchical timer wheel on PIT channel 0)
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+
+#include <freedom.h>
+#include "common.h"
+
+// Pending timers are kept in a wheel of 4 levels of 64 slots.  Level 0 holds
+// timers due in the next 64 ticks, one slot per tick; each higher level
+// covers 64 times the span of the one below.  Every 64 ticks, the next slot
+// of level 1 is cascaded (re-inserted) into level 0, and likewise up the
+// levels.  Insert and cancel are O(1), and each tick only looks at one
+// slot, however many timers are pending.
+#define WHEEL_BITS      6
+#define WHEEL_SLOTS     (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS    4
+#define WHEEL_RANGE     (1UL << (WHEEL_BITS * WHEEL_LEVELS))  // In ticks
+
+#define TIMER_PERIOD    (BUS_CLOCK / TIMER_HZ)  // PIT cycles per tick
+#define IDLE_GUARD      256                     // PIT cycles
+
+static Timer *wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+static volatile uint32_t ticks;         // Ticks processed so far
+static volatile uint32_t late;          // Ticks overdue, after idling
+
+// While idle, the PIT counts down to the next tick with work to do instead
+// of interrupting every tick (see timer_idle())
+static uint32_t idle_ticks;             // Ticks to the next work
+static uint32_t idle_start;             // PIT cycles left in the tick when idle began
+static uint32_t idle_length;            // PIT countdown while idle, 0 if PIT stopped
+static uint8_t idle_stretched;          // Countdown was reprogrammed
+static uint8_t running;                 // timer_init() has started the PIT
+
+// Add a timer to the slot for its expiry time (interrupts disabled)
+static void wheel_insert(Timer *t)
+{
+    uint32_t delta = t->expires - ticks;
+    uint32_t when = t->expires;
+    Timer **slot;
+    int level;
+
+    // Beyond the wheel's range:  park in the furthest slot, and it will be
+    // re-inserted from there
+    if (delta >= WHEEL_RANGE)
+        when = ticks + WHEEL_RANGE - 1;
+
+    for(level=0; level<WHEEL_LEVELS-1; level++)
+        if (delta < 1UL << (WHEEL_BITS * (level + 1)))
+            break;
+    slot = &wheel[level][(when >> (WHEEL_BITS * level)) & WHEEL_MASK];
+
+    t->next = *slot;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+static void unlink(Timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->pprev = NULL;
+}
+
+// Take all the timers from a slot, as a list
+static Timer *wheel_take(Timer **slot)
+{
+    Timer *list = *slot;
+
+    *slot = NULL;
+    return list;
+}
+
+// Re-insert the timers from a slot of a higher level.  Returns the slot
+// index, so the caller knows when to cascade the level above.
+static int cascade(int level)
+{
+    int index = (ticks >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    Timer *t = wheel_take(&wheel[level][index]), *next;
+
+    for(; t; t = next) {
+        next = t->next;
+        wheel_insert(t);
+    }
+    return index;
+}
+
+// Advance one tick, and run the timers that are due
+static void timer_tick(void)
+{
+    Timer *list, *t;
+    int level;
+
+    ticks++;
+    if ((ticks & WHEEL_MASK) == 0)
+        for(level=1; level<WHEEL_LEVELS && cascade(level) == 0; level++)
+            ;
+
+    // Detach the due timers, so callbacks can add or cancel timers freely
+    list = wheel_take(&wheel[0][ticks & WHEEL_MASK]);
+    if (list)
+        list->pprev = &list;
+    while((t = list) != NULL) {
+        unlink(t);
+        t->func(t);
+    }
+}
+
+void PIT_IRQHandler()
+{
+    PIT_TFLG0 = PIT_TFLG_TIF_MASK;              // Clear interrupt
+    timer_tick();
+    for(; late; late--)
+        timer_tick();
+}
+
+// Ticks from now to the next one with work (a timer due, or a slot to
+// cascade), at most max
+static uint32_t wheel_next(uint32_t max)
+{
+    uint32_t next = max, base, when;
+    int level, shift, k;
+
+    for(level=0; level<WHEEL_LEVELS; level++) {
+        shift = WHEEL_BITS * level;
+        base = ticks >> shift;
+        for(k=1; k<=WHEEL_SLOTS; k++) {
+            when = ((base + k) << shift) - ticks;   // When this slot comes up
+            if (when >= next)
+                break;
+            if (wheel[level][(base + k) & WHEEL_MASK]) {
+                next = when;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+// Restart the PIT with count cycles to the next tick
+static void pit_restart(uint32_t count)
+{
+    PIT_TCTRL0 = 0;
+    PIT_TFLG0 = PIT_TFLG_TIF_MASK;
+    PIT_LDVAL0 = count - 1;
+    PIT_TCTRL0 = PIT_TCTRL_TIE_MASK | PIT_TCTRL_TEN_MASK;
+    PIT_LDVAL0 = TIMER_PERIOD - 1;              // Used from the next reload on
+}
+
+//
+// timer_next() -- PIT cycles until the next tick with work to do
+//
+//      Called with interrupts disabled, before sleeping.  Looks at most max
+//      ticks ahead.  Returns 0 if a tick is (nearly) due already.
+//
+uint32_t timer_next(uint32_t max)
+{
+    uint32_t next;
+
+    idle_ticks = 0;
+    if (!running)
+        return 0;
+
+    next = wheel_next(max);
+    idle_start = PIT_CVAL0 + 1;
+    if ((PIT_TFLG0 & PIT_TFLG_TIF_MASK) || idle_start < IDLE_GUARD)
+        return 0;
+    idle_ticks = next;
+    return idle_start + (next - 1) * TIMER_PERIOD;
+}
+
+//
+// timer_idle() -- Stop ticking until the tick found by timer_next()
+//
+//      If stop, the PIT is stopped (the core is going into STOP mode, which
+//      stops the PIT anyway).  Otherwise its countdown is stretched to
+//      interrupt only at that tick.  Follow with timer_resume().
+//
+void timer_idle(int stop)
+{
+    idle_length = idle_start;                   // The tick in progress
+    idle_stretched = 0;
+    if (!idle_ticks)
+        return;
+
+    if (stop) {
+        PIT_TCTRL0 = 0;
+        idle_length = 0;
+        idle_stretched = 1;
+    } else if (idle_ticks > 1) {
+        idle_length += (idle_ticks - 1) * TIMER_PERIOD;
+        pit_restart(idle_length);
+        idle_stretched = 1;
+    }
+}
+
+//
+// timer_resume() -- Resume ticking after sleeping, returns PIT cycles slept
+//
+//      stopped is the time (in PIT cycles) that the PIT was stopped.  The
+//      ticks skipped had nothing to do, so they are just counted; the last
+//      one runs from the PIT interrupt as usual.
+//
+uint32_t timer_resume(uint32_t stopped)
+{
+    uint32_t elapsed = stopped, passed = 0, left, tif, count;
+
+    if (!idle_ticks)
+        return 0;
+
+    // How far did the countdown get?  (If it reached the end, it has 
+    // reloaded with the tick period.)
+    if (idle_length) {
+        tif = PIT_TFLG0;
+        count = PIT_CVAL0;
+        if (PIT_TFLG0 != tif) {
+            tif = PIT_TFLG0;
+            count = PIT_CVAL0;
+        }
+        elapsed += idle_length - 1 - count;
+        if (tif & PIT_TFLG_TIF_MASK)
+            elapsed += TIMER_PERIOD;
+    }
+    if (!idle_stretched)                        // Nothing else to fix up
+        return elapsed;
+
+    // Count the ticks passed, and restart the PIT in phase with them
+    if (elapsed >= idle_start) {
+        passed = 1 + (elapsed - idle_start) / TIMER_PERIOD;
+        left = TIMER_PERIOD - (elapsed - idle_start) % TIMER_PERIOD;
+    } else
+        left = idle_start - elapsed;
+    pit_restart(left);
+
+    if (passed) {
+        if (passed > idle_ticks) {              // Woke late:  catch up
+            late += passed - idle_ticks;
+            passed = idle_ticks;
+        }
+        ticks += passed - 1;
+        NVIC_ISPR = 1 << (INT_PIT - 16);        // Run the last from the interrupt
+    }
+    return elapsed;
+}
+
+//
+// timer_start() -- Call func(t) from the timer interrupt in ms milliseconds
+//
+//      Restarts the timer if it's already pending.  func may restart its
+//      own timer (for a periodic timer) or start/cancel others.
+//
+void timer_start(Timer *t, uint32_t ms, void (*func)(Timer *t), void *arg)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (t->pprev)
+        unlink(t);
+    t->func = func;
+    t->arg = arg;
+    t->expires = ticks + (ms ? ms : 1) * (TIMER_HZ / 1000);
+    wheel_insert(t);
+    __set_PRIMASK(primask);
+}
+
+// Stop a timer, if it's pending
+void timer_cancel(Timer *t)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (t->pprev)
+        unlink(t);
+    __set_PRIMASK(primask);
+}
+
+// Ticks since timer_init()
+uint32_t timer_ticks(void)
+{
+    return ticks;
+}
+
+// Start the tick interrupt, from the bus clock
+void timer_init(void)
+{
+    SIM_SCGC6 |= SIM_SCGC6_PIT_MASK;
+    PIT_MCR = PIT_MCR_FRZ_MASK;                 // Enable, stop in debug halt
+    PIT_TCTRL0 = 0;
+    PIT_LDVAL0 = TIMER_PERIOD - 1;
+    PIT_TFLG0 = PIT_TFLG_TIF_MASK;
+    PIT_TCTRL0 = PIT_TCTRL_TIE_MASK | PIT_TCTRL_TEN_MASK;
+    enable_irq(INT_PIT);
+    running = 1;
+}
@@ -0,0 +1,26 @@
+//
+// tprintf.c -- Small replacement for newlib's iprintf()
+//
+//  Copyright (c) 2012-2013 Andrew Payne <andy@payne.org>
+//
+//  Linked ahead of the C library when PRINTF=tiny (see the Makefile), so
+//  iprintf() formats with fmt.c straight into the console's transmit
+//  buffer, without newlib's formatter, stdio buffers or heap.
+//
+//  Note:  output bypasses stdout, so don't mix iprintf() with buffered
+//  stdio output (e.g. puts()) without an fflush().
+//
+
+#include <freedom.h>
+#include "common.h"
+
+int iprintf(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = uart_port_vprintf(0, fmt, ap);
+    va_end(ap);
+    return n;
+}
@@ -7,117 +7,782 @@
 #include <freedom.h>
 #include "common.h"
 
-// Circular buffers for transmit and receive
+// Circular buffers for transmit and receive, one pair per port.  The write
+// functions produce into tx_buffer and the interrupt handler (or DMA)
+// consumes it; the reverse for rx_buffer.
 #define BUFLEN 128
 
-static uint8_t _tx_buffer[sizeof(RingBuffer) + BUFLEN] __attribute__ ((aligned(4)));
-static uint8_t _rx_buffer[sizeof(RingBuffer) + BUFLEN] __attribute__ ((aligned(4)));
+static uint8_t _tx_buffer[UART_PORTS][sizeof(RingBuffer) + BUFLEN] __attribute__ ((aligned(4)));
+static uint8_t _rx_buffer[UART_PORTS][sizeof(RingBuffer) + BUFLEN] __attribute__ ((aligned(4)));
 
-static RingBuffer *const tx_buffer = (RingBuffer *) &_tx_buffer;
-static RingBuffer *const rx_buffer = (RingBuffer *) &_rx_buffer;
+// Receive by DMA:  the DMA channel writes UART0's rx_buffer data circularly
+// (see rx_dma_publish()).  Set to 0 to receive by interrupts.
+#ifndef UART_RX_DMA
+#define UART_RX_DMA 1
+#endif
 
-void UART0_IRQHandler()
+#if UART_RX_DMA
+// The circular DMA buffer must be aligned to its size, so UART0's rx_buffer
+// header goes just below a BUFLEN boundary, and its data just above
+static uint8_t _rx0_buffer[2 * BUFLEN] __attribute__ ((aligned(BUFLEN)));
+#define RX0_BUFFER  ((RingBuffer *) (_rx0_buffer + BUFLEN - sizeof(RingBuffer)))
+#else
+#define RX0_BUFFER  ((RingBuffer *) _rx_buffer[0])
+#endif
+
+// Per port state.  UART0 is the low power UART (UARTLP), whose register
+// layout matches UART1/2 up to the data register, so all ports are accessed
+// through the common UART layout and only UART0's C4/C5 are used by name.
+typedef struct {
+    UART_MemMapPtr regs;
+    RingBuffer *tx_buffer;
+    RingBuffer *rx_buffer;
+    uint8_t tx_dma;                 // Transmit/receive by DMA (UART0 only)
+    uint8_t rx_dma;
+    uint8_t flow;                   // Receive flow control (UART_FLOW_xxx)
+    uint8_t busy;                   // Sending/receiving (PORT_xx), with a
+                                    //   sleep_lock() held
+    volatile uint8_t rx_heard;      // Received since the last idle check
+    Timer rx_idle;                  // Idle check while receiving
+    volatile uint8_t rx_stopped;    // Sender has been told to stop
+    volatile uint8_t tx_flow_char;  // XON/XOFF to send ahead of tx_buffer
+    GPIO_MemMapPtr rts_gpio;        // RTS output (UART_FLOW_RTS)
+    uint32_t rts_mask;
+} UartPort;
+
+static UartPort ports[UART_PORTS] = {
+    { (UART_MemMapPtr) UART0_BASE_PTR, (RingBuffer *) _tx_buffer[0], RX0_BUFFER },
+    { UART1_BASE_PTR, (RingBuffer *) _tx_buffer[1], (RingBuffer *) _rx_buffer[1] },
+    { UART2_BASE_PTR, (RingBuffer *) _tx_buffer[2], (RingBuffer *) _rx_buffer[2] },
+};
+
+static UartPort *const uart0 = &ports[0];
+
+// Receive flow control watermarks:  the sender is stopped when rx_buffer
+// reaches RX_HIGH bytes, and restarted once it drains to RX_LOW.  The space
+// above RX_HIGH absorbs what the sender has in flight when it is stopped.
+// With receive DMA, blocks end at RX_HIGH (see rx_dma_arm()), so the sender
+// is stopped from the block's completion interrupt at the same point.
+#define RX_HIGH     (BUFLEN * 3 / 4)
+#define RX_LOW      (BUFLEN / 4)
+
+#define XON         0x11
+#define XOFF        0x13
+
+// A port holds a sleep_lock() only while it's busy, as its clock stops in
+// STOP mode.  Sending, that's until the last byte has left the shift
+// register (the transmit complete interrupt).  Receiving, it's until the
+// line has been quiet for RX_IDLE_MS.  An idle port watches for a start
+// bit with the receive edge interrupt, which also wakes the board from
+// STOP.  The character that does that is lost, though, as are any more
+// before the clocks are running again:  a caller that needs every byte
+// should hold its own sleep_lock().  (Normal STOP wakes on any interrupt;
+// the LLWU is only needed for the low leakage modes, which aren't used.)
+#define PORT_TX         0x01                // busy:  sending
+#define PORT_RX         0x02                //   ...receiving
+#define RX_IDLE_MS      20
+
+// Mark the port busy for a reason (interrupts disabled)
+static void port_hold(UartPort *u, int why)
+{
+    if (!u->busy)
+        sleep_lock();
+    u->busy |= why;
+}
+
+// ...and no longer for that reason
+static void port_release(UartPort *u, int why)
+{
+    if (u->busy) {
+        u->busy &= ~why;
+        if (!u->busy)
+            sleep_unlock();
+    }
+}
+
+// Turn the receive edge interrupt on or off, clearing any stale edge
+static void rx_edge_enable(UartPort *u, int enable)
+{
+    UART_MemMapPtr regs = u->regs;
+
+    regs->S2 = (regs->S2 & ~UART_S2_LBKDIF_MASK) | UART_S2_RXEDGIF_MASK;
+    if (enable)
+        regs->BDH |= UART_BDH_RXEDGIE_MASK;
+    else
+        regs->BDH &= ~UART_BDH_RXEDGIE_MASK;
+}
+
+static void rx_idle_check(Timer *t);
+
+// Something was received (interrupts disabled)
+static void rx_active(UartPort *u)
+{
+    u->rx_heard = 1;
+    if (!(u->busy & PORT_RX)) {
+        port_hold(u, PORT_RX);
+        timer_start(&u->rx_idle, RX_IDLE_MS, rx_idle_check, u);
+    }
+}
+
+// Tell the sender to go (RTS asserted low, or XON) or stop
+static void flow_signal(UartPort *u, int go)
+{
+    if (u->flow == UART_FLOW_RTS) {
+        if (go)
+            u->rts_gpio->PCOR = u->rts_mask;
+        else
+            u->rts_gpio->PSOR = u->rts_mask;
+    } else {
+        port_hold(u, PORT_TX);
+        u->tx_flow_char = go ? XON : XOFF;
+        u->regs->C2 |= UART_C2_TIE_MASK;    // Sent by the interrupt handler
+    }
+}
+
+// Called after adding to rx_buffer (interrupt context)
+static void rx_flow_check(UartPort *u)
 {
+    if (u->flow && !u->rx_stopped && buf_len(u->rx_buffer) >= RX_HIGH) {
+        u->rx_stopped = 1;
+        flow_signal(u, 0);
+    }
+}
+
+// Called after reading from rx_buffer (interrupts disabled)
+static void rx_flow_resume(UartPort *u)
+{
+    if (u->flow && u->rx_stopped && buf_len(u->rx_buffer) <= RX_LOW) {
+        u->rx_stopped = 0;
+        flow_signal(u, 1);
+    }
+}
+
+// Transmit by DMA:  each contiguous block of UART0's tx_buffer is sent with
+// one DMA transfer and one completion interrupt, rather than an interrupt
+// per byte.  The block is claimed (see buf_claim()) rather than held at the
+// head while it's sent, so overwrite mode can still discard the oldest
+// unsent data.  Set to 0 to use the interrupt handler instead.
+#ifndef UART_TX_DMA
+#define UART_TX_DMA 1
+#endif
+
+#if UART_TX_DMA
+static volatile int tx_dma_len;             // Bytes in the DMA block (0=idle)
+
+// If the DMA channel is idle, start sending the next block of tx_buffer.
+// If there's nothing more, wait for the last byte to go (see uart_irq()).
+static void tx_dma_start(void)
+{
+    BufSpan span[2];
+
+    if (tx_dma_len)
+        return;
+    if (buf_peek(uart0->tx_buffer, span) == 0) {
+        UART0_C2 |= UART_C2_TCIE_MASK;
+        return;
+    }
+
+    tx_dma_len = span[0].len;
+    buf_claim(uart0->tx_buffer, tx_dma_len);
+    DMA_SAR(DMA_UART0_TX) = (uint32_t) span[0].data;
+    DMA_DSR_BCR(DMA_UART0_TX) = DMA_DSR_BCR_BCR(span[0].len);
+
+    // Byte transfers, one per UART request, stopping when the count is done
+    DMA_DCR(DMA_UART0_TX) = DMA_DCR_EINT_MASK | DMA_DCR_ERQ_MASK
+                    | DMA_DCR_CS_MASK | DMA_DCR_SINC_MASK | DMA_DCR_SSIZE(1)
+                    | DMA_DCR_DSIZE(1) | DMA_DCR_D_REQ_MASK;
+}
+
+// DMA transmit block complete
+void DMA0_IRQHandler()
+{
+    DMA_DSR_BCR(DMA_UART0_TX) = DMA_DSR_BCR_DONE_MASK;     // Clear status
+    buf_unclaim(uart0->tx_buffer, tx_dma_len);
+    tx_dma_len = 0;
+    tx_dma_start();
+}
+#endif
+
+// Anything left to send?
+static int tx_busy(UartPort *u)
+{
+#if UART_TX_DMA
+    if (u->tx_dma && tx_dma_len)
+        return 1;
+#endif
+    return u->tx_flow_char || !buf_isempty(u->tx_buffer);
+}
+
+#if UART_RX_DMA
+// The channel writes rx_buffer's data circularly (DMOD), so it never has to
+// be pointed at the free space.  Its byte count is armed a block of at most
+// RX_DMA_BLOCK bytes at a time, and each block's completion interrupt adds
+// the received bytes to the buffer, so they're added at least that often
+// however fast they arrive.  They're also added when the line goes idle (so
+// messages arrive with low latency) and when a reader looks.  If the reader
+// falls behind, the DMA writes over the oldest bytes:  those are dropped
+// and counted (see uart_port_rx_drops()).
+#define RX_DMA_BLOCK    (BUFLEN / 4)
+#define RX_DMA_DMOD     4                   // 128 byte (BUFLEN) circular buffer
+
+static uint32_t rx_dma_count;               // Byte count when last published
+static uint32_t rx_overruns;                // Bytes lost by the receiver
+
+// Arm the byte count for the next block.  With flow control, the block ends
+// at the high watermark, so its completion interrupt stops the sender in
+// time.
+static void rx_dma_arm(void)
+{
+    int len = RX_DMA_BLOCK, room;
+
+    if (uart0->flow && !uart0->rx_stopped) {
+        room = RX_HIGH - buf_len(uart0->rx_buffer);
+        if (room > 0 && room < len)
+            len = room;
+    }
+    DMA_DSR_BCR(DMA_UART0_RX) = DMA_DSR_BCR_BCR(len);
+    rx_dma_count = len;
+}
+
+// Start the channel (at init), receiving at rx_buffer's tail
+static void rx_dma_start(void)
+{
+    RingBuffer *buf = uart0->rx_buffer;
+
+    UART0_S1 = UARTLP_S1_OR_MASK;           // Clear any overrun
+    DMA_DAR(DMA_UART0_RX) = (uint32_t) buf->data;
+    rx_dma_arm();
+    DMA_DCR(DMA_UART0_RX) = DMA_DCR_EINT_MASK | DMA_DCR_ERQ_MASK
+                    | DMA_DCR_CS_MASK | DMA_DCR_DINC_MASK | DMA_DCR_SSIZE(1)
+                    | DMA_DCR_DSIZE(1) | DMA_DCR_DMOD(RX_DMA_DMOD);
+}
+
+// Add the bytes received since last time to rx_buffer
+static void rx_dma_publish(void)
+{
+    uint32_t count = DMA_DSR_BCR(DMA_UART0_RX) & DMA_DSR_BCR_BCR_MASK;
+
+    if (count == rx_dma_count)
+        return;
+    buf_commit_over(uart0->rx_buffer, rx_dma_count - count);
+    rx_dma_count = count;
+    rx_flow_check(uart0);
+    rx_active(uart0);
+}
+
+// DMA receive block complete:  publish it, and arm the next.  (The
+// destination address carries on around the buffer.)
+void DMA1_IRQHandler()
+{
+    rx_dma_publish();
+    DMA_DSR_BCR(DMA_UART0_RX) = DMA_DSR_BCR_DONE_MASK;     // Clear status
+    rx_dma_arm();
+
+    // A byte that arrived before the re-arm could be taken was lost
+    if (UART0_S1 & UARTLP_S1_OR_MASK) {
+        UART0_S1 = UARTLP_S1_OR_MASK;
+        rx_overruns++;
+    }
+}
+#endif
+
+// Every RX_IDLE_MS while receiving:  once nothing more has arrived, let the
+// board STOP, and watch for the next start bit
+static void rx_idle_check(Timer *t)
+{
+    UartPort *u = t->arg;
+
+#if UART_RX_DMA
+    if (u->rx_dma)
+        rx_dma_publish();
+#endif
+    if (u->rx_heard) {
+        u->rx_heard = 0;
+        timer_start(t, RX_IDLE_MS, rx_idle_check, u);
+    } else {
+        rx_edge_enable(u, 1);
+        port_release(u, PORT_RX);
+    }
+}
+
+// Called after writing to tx_buffer:  start sending
+static void tx_start(UartPort *u)
+{
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    port_hold(u, PORT_TX);
+    __set_PRIMASK(primask);
+#if UART_TX_DMA
+    if (u->tx_dma) {
+        tx_dma_start();
+        return;
+    }
+#endif
+    u->regs->C2 |= UART_C2_TIE_MASK;        // Turn on Tx interrupts
+}
+
+// Called after reading from rx_buffer:  resume receiving if it was full
+static void rx_resume(UartPort *u)
+{
+    if (u->flow) {
+        __disable_irq();
+        rx_flow_resume(u);
+        __enable_irq();
+    }
+    if (u->rx_dma)                          // (Never stops)
+        return;
+    u->regs->C2 |= UART_C2_RIE_MASK;        // Turn on Rx interrupt
+}
+
+// Anything received?  (With DMA, adds what it has received so far.)
+static int rx_ready(UartPort *u)
+{
+#if UART_RX_DMA
+    uint32_t primask;
+
+    if (u->rx_dma) {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        rx_dma_publish();
+        __set_PRIMASK(primask);
+    }
+#endif
+    return !buf_isempty(u->rx_buffer);
+}
+
+// Copy out received bytes.  With DMA, interrupts are masked meanwhile, as
+// an overflow moves the head (see buf_commit_over()).
+static int rx_read(UartPort *u, char *p, int len)
+{
+#if UART_RX_DMA
+    uint32_t primask;
+    int n;
+
+    if (u->rx_dma) {
+        primask = __get_PRIMASK();
+        __disable_irq();
+        rx_dma_publish();
+        n = buf_read(u->rx_buffer, (uint8_t *) p, len);
+        __set_PRIMASK(primask);
+        return n;
+    }
+#endif
+    return buf_read(u->rx_buffer, (uint8_t *) p, len);
+}
+
+static void uart_irq(UartPort *u)
+{
+    UART_MemMapPtr regs = u->regs;
     int status;
-    
-    status = UART0_S1;
-    
-    // If transmit data register empty, and data in the transmit buffer,
-    // send it.  If it leaves the buffer empty, disable the transmit interrupt.
-    if ((status & UART_S1_TDRE_MASK) && !buf_isempty(tx_buffer)) {
-        UART0_D = buf_get_byte(tx_buffer);
-        if(buf_isempty(tx_buffer))
-            UART0_C2 &= ~UART_C2_TIE_MASK;
-    }
-    
+
+    status = regs->S1;
+
+    // Note:  the write and read functions set TIE/RIE with a read-modify-write
+    // of C2 that can race with this handler clearing the other bit, so an
+    // interrupt may be left enabled with nothing to do.  The checks below
+    // turn it back off rather than assuming it was needed.
+
+    // If transmit data register empty, and an XON/XOFF or data in the
+    // transmit buffer, send it.  If there's nothing more, disable the
+    // transmit interrupt, and wait for the last byte to go.  (With DMA, TIE
+    // requests DMA transfers rather than interrupts.)
+    if (!u->tx_dma && (status & UART_S1_TDRE_MASK)
+                   && (regs->C2 & UART_C2_TIE_MASK)) {
+        if (u->tx_flow_char) {
+            regs->D = u->tx_flow_char;
+            u->tx_flow_char = 0;
+        } else if(!buf_isempty(u->tx_buffer))
+            regs->D = buf_get_byte(u->tx_buffer);
+        if(buf_isempty(u->tx_buffer))
+            regs->C2 = (regs->C2 & ~UART_C2_TIE_MASK) | UART_C2_TCIE_MASK;
+    }
+
+    // If everything has been sent, the port may let the board STOP (unless
+    // more was queued meanwhile, which will come back here)
+    if ((status & UART_S1_TC_MASK) && (regs->C2 & UART_C2_TCIE_MASK)) {
+        regs->C2 &= ~UART_C2_TCIE_MASK;
+        if (!tx_busy(u))
+            port_release(u, PORT_TX);
+    }
+
+    // A start bit on an idle line (perhaps what woke the board from STOP)
+    if ((regs->BDH & UART_BDH_RXEDGIE_MASK) && (regs->S2 & UART_S2_RXEDGIF_MASK)) {
+        rx_edge_enable(u, 0);
+        rx_active(u);
+    }
+
+#if UART_RX_DMA
+    // If the line has gone idle, pass on what the DMA has received so far
+    if (u->rx_dma) {
+        if (status & UARTLP_S1_IDLE_MASK) {
+            UART0_S1 = UARTLP_S1_IDLE_MASK; // Clear flag
+            rx_dma_publish();
+        }
+        return;
+    }
+#endif
+
     // If there is received data, read it into the receive buffer.  If the
     // buffer is full, disable the receive interrupt.
-    if ((status & UART_S1_RDRF_MASK) && !buf_isfull(rx_buffer)) {
-        buf_put_byte(rx_buffer, UART0_D);
-        if(buf_isfull(rx_buffer))
-            UART0_C2 &= ~UART_C2_RIE_MASK;
+    if (status & UART_S1_RDRF_MASK) {
+        if(!buf_isfull(u->rx_buffer))
+            buf_put_byte(u->rx_buffer, regs->D);
+        rx_flow_check(u);
+        rx_active(u);
+        if(buf_isfull(u->rx_buffer))
+            regs->C2 &= ~UART_C2_RIE_MASK;
     }
 }
 
-int uart_write(char *p, int len)
+void UART0_IRQHandler() { uart_irq(&ports[0]); }
+void UART1_IRQHandler() { uart_irq(&ports[1]); }
+void UART2_IRQHandler() { uart_irq(&ports[2]); }
+
+int uart_port_write(int port, char *p, int len)
 {
-    int i;
-    
-    for(i=0; i<len; i++) {
-        while(buf_isfull(tx_buffer))        // Spin wait while full
-            ;
-        buf_put_byte(tx_buffer, *p++);
-        UART0_C2 |= UART_C2_TIE_MASK;           // Turn on Tx interrupts
+    UartPort *u = &ports[port];
+    int n, i = len;
+
+    // In overwrite mode, never wait:  old data is discarded to make room
+    if (u->tx_buffer->flags & BUF_OVERWRITE) {
+        buf_write(u->tx_buffer, (uint8_t *) p, len);
+        tx_start(u);
+        return len;
+    }
+
+    while(i > 0) {
+        SLEEP_UNTIL(!buf_isfull(u->tx_buffer));
+        n = buf_write(u->tx_buffer, (uint8_t *) p, i);
+        p += n;
+        i -= n;
+        tx_start(u);
     }
     return len;
 }
 
-// A blocking write, useful for error/crash/debug reporting
+// Like uart_port_write(), but never waits:  queues as much as fits and
+// returns the number of bytes queued (possibly 0)
+int uart_port_try_write(int port, char *p, int len)
+{
+    UartPort *u = &ports[port];
+    int n;
+
+    if (u->tx_buffer->flags & BUF_OVERWRITE)
+        return uart_port_write(port, p, len);
+
+    n = buf_write(u->tx_buffer, (uint8_t *) p, len);
+    tx_start(u);
+    return n;
+}
+
+// Select whether uart_port_write() waits for room in the transmit buffer
+// (the default), or discards the oldest unsent data
+void uart_port_set_overwrite(int port, int enable)
+{
+    buf_set_overwrite(ports[port].tx_buffer, enable);
+}
+
+// Number of bytes discarded by uart_port_write() in overwrite mode
+uint32_t uart_port_tx_drops(int port)
+{
+    return buf_drops(ports[port].tx_buffer);
+}
+
+// Number of received bytes lost because they weren't read in time (UART0
+// with receive DMA:  written over, or overrun while re-arming)
+uint32_t uart_port_rx_drops(int port)
+{
+#if UART_RX_DMA
+    if (ports[port].rx_dma)
+        return buf_drops(ports[port].rx_buffer) + rx_overruns;
+#endif
+    return buf_drops(ports[port].rx_buffer);
+}
+
+int uart_port_read(int port, char *p, int len)
+{
+    UartPort *u = &ports[port];
+    int n, i = len;
+
+    while(i > 0) {
+        SLEEP_UNTIL(rx_ready(u));
+
+        n = rx_read(u, p, i);
+        p += n;
+        i -= n;
+        rx_resume(u);
+    }
+    return len - i;
+}
+
+// Like uart_port_read(), but never waits:  returns the bytes available, up
+// to len
+int uart_port_try_read(int port, char *p, int len)
+{
+    UartPort *u = &ports[port];
+    int n = rx_read(u, p, len);
+
+    rx_resume(u);
+    return n;
+}
+
+//
+// uart_port_flow() -- Select receive flow control for a port
+//
+//      UART_FLOW_RTS drives rts_pin of rts_gpio as an active low RTS output.
+//      The pin must already be set up as GPIO (PORT_PCR_MUX(1)).
+//
+//      UART_FLOW_XONXOFF sends XOFF/XON in band.  It's not available with
+//      transmit DMA, which can't have a byte inserted ahead of it.
+//
+//      Call after uart_port_init(), which turns flow control off.  Returns
+//      0, or -1 if the mode isn't possible.
+//
+int uart_port_flow(int port, int mode, GPIO_MemMapPtr rts_gpio, int rts_pin)
+{
+    UartPort *u = &ports[port];
+
+    if ((mode == UART_FLOW_RTS && !rts_gpio) 
+            || (mode == UART_FLOW_XONXOFF && u->tx_dma))
+        return -1;
+
+    __disable_irq();
+    u->flow = UART_FLOW_NONE;
+    u->rx_stopped = 0;
+    u->tx_flow_char = 0;
+    if (mode == UART_FLOW_RTS) {
+        u->rts_gpio = rts_gpio;
+        u->rts_mask = 1 << rts_pin;
+        rts_gpio->PCOR = u->rts_mask;       // Asserted (low) to start
+        rts_gpio->PDDR |= u->rts_mask;
+    }
+    u->flow = mode;
+    rx_flow_check(u);
+    __enable_irq();
+    return 0;
+}
+
+// Formatted output sink (see fmt.h) writing into the free space of a
+// transmit buffer.  The space is reserved a span at a time and committed
+// when full, so there's no intermediate buffer.
+typedef struct {
+    FmtSink sink;
+    UartPort *u;
+    char *start;                            // Start of the reserved span
+} UartSink;
+
+static void uart_sink_more(FmtSink *s)
+{
+    UartSink *us = (UartSink *) s;
+    RingBuffer *buf = us->u->tx_buffer;
+    BufSpan span[2];
+
+    buf_commit(buf, s->p - us->start);
+    tx_start(us->u);
+
+    // In overwrite mode, never wait:  drop this character instead
+    if (buf_isfull(buf) && (buf->flags & BUF_OVERWRITE)) {
+        buf->drops++;
+        s->p = s->end = us->start = NULL;
+        return;
+    }
+    SLEEP_UNTIL(!buf_isfull(buf));
+    buf_reserve(buf, span);
+    s->p = us->start = (char *) span[0].data;
+    s->end = s->p + span[0].len;
+}
+
+int uart_port_vprintf(int port, const char *fmt, va_list ap)
+{
+    UartSink us;
+    int n;
+
+    us.u = &ports[port];
+    us.sink.p = us.sink.end = us.start = NULL;  // Reserve on first output
+    us.sink.more = uart_sink_more;
+    n = fmt_vformat(&us.sink, fmt, ap);
+    buf_commit(us.u->tx_buffer, us.sink.p - us.start);
+    tx_start(us.u);
+    return n;
+}
+
+int uart_port_printf(int port, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = uart_port_vprintf(port, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+// UART0 is the debug console (stdin/stdout/stderr)
+int uart_write(char *p, int len)            { return uart_port_write(0, p, len); }
+int uart_try_write(char *p, int len)        { return uart_port_try_write(0, p, len); }
+int uart_read(char *p, int len)             { return uart_port_read(0, p, len); }
+int uart_try_read(char *p, int len)         { return uart_port_try_read(0, p, len); }
+void uart_set_overwrite(int enable)         { uart_port_set_overwrite(0, enable); }
+uint32_t uart_tx_drops(void)                { return uart_port_tx_drops(0); }
+uint32_t uart_rx_drops(void)                { return uart_port_rx_drops(0); }
+int uart_init(int baud_rate)                { return uart_port_init(0, baud_rate); }
+
+// A blocking write, useful for error/crash/debug reporting.  A transmit DMA
+// block in progress is paused meanwhile (masking interrupts doesn't stop the
+// DMA), and carries on afterwards.
 int uart_write_err(char *p, int len)
 {
+    uint32_t primask = __get_PRIMASK();
     int i;
-    
+#if UART_TX_DMA
+    uint8_t c5;
+    uint32_t dcr;
+#endif
+
     __disable_irq();
+#if UART_TX_DMA
+    c5 = UART0_C5;
+    dcr = DMA_DCR(DMA_UART0_TX);
+    UART0_C5 = c5 & ~UARTLP_C5_TDMAE_MASK;
+    DMA_DCR(DMA_UART0_TX) = dcr & ~DMA_DCR_ERQ_MASK;
+    while (DMA_DSR_BCR(DMA_UART0_TX) & DMA_DSR_BCR_BSY_MASK)
+        ;                                   // (Byte in flight)
+#endif
     for(i=0; i<len; i++) {
         while((UART0_S1 & UART_S1_TDRE_MASK) == 0)  // Wait until transmit buffer empty
             ;
-        
+
         UART0_D = *p++;                     // Send char
     }
-    __enable_irq();
+#if UART_TX_DMA
+    DMA_DCR(DMA_UART0_TX) = dcr;
+    UART0_C5 = c5;
+#endif
+    __set_PRIMASK(primask);
     return len;
 }
 
-int uart_read(char *p, int len)
+//
+// uart_port_init() -- Initialize a UART
+//
+//      UART0:  OpenSDA debug port, pins 27/28, PTA1/PTA2 (ALT2)
+//      UART1:  TX on PTE0, RX on PTE1 (ALT3)
+//      UART2:  TX on PTD3, RX on PTD2 (ALT3)
+//
+//      Returns the baud rate actually achieved, or -1 if it's out of range
+//      or can't be set within 3% (BAUD_ERROR_MAX)
+//
+int uart_port_init(int port, int baud_rate)
 {
-    int i = len;
+    UartPort *u;
+    UART_MemMapPtr regs;
+    BaudConfig cfg;
+    int err;
 
-    while(i > 0) {
-        while(buf_isempty(rx_buffer))           // Spin wait
-            ;
+    if (port < 0 || port >= UART_PORTS || baud_rate <= 0)
+        return -1;
+    u = &ports[port];
+    regs = u->regs;
+
+    // UART0 runs from the 48Mhz clock with a variable oversampling ratio,
+    // UART1 and UART2 from the bus clock with fixed 16x oversampling
+    if (port == 0)
+        err = baud_search(CORE_CLOCK, baud_rate, &cfg);
+    else
+        err = baud_search_range(BUS_CLOCK, baud_rate, 16, 16, &cfg);
+    if (err < 0)
+        return -1;
 
-        *p++ = buf_get_byte(rx_buffer);
-        UART0_C2 |= UART_C2_RIE_MASK;           // Turn on Rx interrupt
-        i--;
+    switch(port) {
+     case 0:
+        // Turn on clock to UART0 module and select 48Mhz clock (FLL/PLL source)
+        SIM_SCGC5 |= SIM_SCGC5_PORTA_MASK;
+        SIM_SCGC4 |= SIM_SCGC4_UART0_MASK;
+        SIM_SOPT2 &= ~SIM_SOPT2_UART0SRC_MASK;
+        SIM_SOPT2 |= SIM_SOPT2_UART0SRC(1);             // FLL/PLL source
+
+        // Select "Alt 2" usage to enable UART0 on pins
+        PORTA_PCR1 = PORT_PCR_MUX(2);
+        PORTA_PCR2 = PORT_PCR_MUX(2);
+        break;
+     case 1:
+        SIM_SCGC5 |= SIM_SCGC5_PORTE_MASK;
+        SIM_SCGC4 |= SIM_SCGC4_UART1_MASK;
+        PORTE_PCR0 = PORT_PCR_MUX(3);
+        PORTE_PCR1 = PORT_PCR_MUX(3);
+        break;
+     case 2:
+        SIM_SCGC5 |= SIM_SCGC5_PORTD_MASK;
+        SIM_SCGC4 |= SIM_SCGC4_UART2_MASK;
+        PORTD_PCR2 = PORT_PCR_MUX(3);
+        PORTD_PCR3 = PORT_PCR_MUX(3);
+        break;
     }
-    return len - i;
-}
 
-//
-// uart_init() -- Initialize debug / OpenSDA UART0
-//
-//      The OpenSDA UART RX/TX is connected to pins 27/28, PTA1/PTA2 (ALT2)
-//
-void uart_init(int baud_rate)
-{
-    SIM_SCGC5 |= SIM_SCGC5_PORTA_MASK;
-        
-    // Turn on clock to UART0 module and select 48Mhz clock (FLL/PLL source)
-    SIM_SCGC4 |= SIM_SCGC4_UART0_MASK;
-    SIM_SOPT2 &= ~SIM_SOPT2_UART0SRC_MASK;
-    SIM_SOPT2 |= SIM_SOPT2_UART0SRC(1);                 // FLL/PLL source
-
-    // Select "Alt 2" usage to enable UART0 on pins
-    PORTA_PCR1 = PORT_PCR_MUX(2);
-    PORTA_PCR2 = PORT_PCR_MUX(2);
-
-    UART0_C2 = 0;
-    UART0_C1 = 0;
-    UART0_C3 = 0;
-    UART0_S2 = 0;     
-
-    // Set the baud rate divisor
-    #define OVER_SAMPLE 16
-    uint16_t divisor = (CORE_CLOCK / OVER_SAMPLE) / baud_rate;
-    UART0_C4 = UARTLP_C4_OSR(OVER_SAMPLE - 1);
-    UART0_BDH = (divisor >> 8) & UARTLP_BDH_SBR_MASK;
-    UART0_BDL = (divisor & UARTLP_BDL_SBR_MASK);
-
-    // Initialize transmit and receive circular buffers
-    buf_reset(tx_buffer, BUFLEN);
-    buf_reset(rx_buffer, BUFLEN);
+    regs->C2 = 0;
+    regs->C1 = 0;
+    regs->C3 = 0;
+    regs->S2 = 0;
+
+    // Set the oversampling ratio (UART0 only) and baud rate divisor.  Below
+    // 8x, the receiver must sample on both clock edges.
+    if (port == 0) {
+        UART0_C4 = UARTLP_C4_OSR(cfg.osr - 1);
+        UART0_C5 = cfg.osr < 8 ? UARTLP_C5_BOTHEDGE_MASK : 0;
+    }
+    regs->BDH = (cfg.sbr >> 8) & UART_BDH_SBR_MASK;
+    regs->BDL = (cfg.sbr & UART_BDL_SBR_MASK);
+
+    // Initialize transmit and receive circular buffers, with no flow control
+    buf_reset(u->tx_buffer, BUFLEN);
+    buf_reset(u->rx_buffer, BUFLEN);
+    u->flow = UART_FLOW_NONE;
+    u->rx_stopped = 0;
+    u->tx_flow_char = 0;
+
+    // Idle, so no longer keeping the board out of STOP (see port_hold())
+    __disable_irq();
+    timer_cancel(&u->rx_idle);
+    port_release(u, PORT_TX | PORT_RX);
+    u->rx_heard = 0;
+    __enable_irq();
 
     // Enable the transmitter, receiver, and receive interrupts
-    UART0_C2 = UARTLP_C2_RE_MASK | UARTLP_C2_TE_MASK | UART_C2_RIE_MASK;
-    enable_irq(INT_UART0);
+    uint8_t c2 = UART_C2_RE_MASK | UART_C2_TE_MASK | UART_C2_RIE_MASK;
+
+#if UART_TX_DMA
+    // Route UART0 transmit requests to the DMA channel.  With TDMAE set,
+    // TIE requests DMA transfers instead of interrupts, so it stays on.
+    if (port == 0) {
+        u->tx_dma = 1;
+        tx_dma_len = 0;
+        dma_init(DMA_UART0_TX, DMAMUX_UART0_TX);
+        DMA_DAR(DMA_UART0_TX) = (uint32_t) &UART0_D;
+        UART0_C5 |= UARTLP_C5_TDMAE_MASK;
+        c2 |= UART_C2_TIE_MASK;
+    }
+#endif
+
+#if UART_RX_DMA
+    // Likewise for receive requests (with RIE), plus the idle line interrupt
+    if (port == 0) {
+        u->rx_dma = 1;
+        rx_overruns = 0;
+        dma_init(DMA_UART0_RX, DMAMUX_UART0_RX);
+        DMA_SAR(DMA_UART0_RX) = (uint32_t) &UART0_D;
+        UART0_C5 |= UARTLP_C5_RDMAE_MASK;
+        c2 |= UART_C2_ILIE_MASK;
+    }
+#endif
+
+    regs->C2 = c2;
+    rx_edge_enable(u, 1);
+
+#if UART_RX_DMA
+    if (u->rx_dma)
+        rx_dma_start();
+#endif
+    enable_irq(INT_UART0 + port);
+    return cfg.baud;
 }
@@ -419,13 +419,13 @@ static void usb_setup_device(endpoint_t *ep, USB_SETUP *setup)
                     else
                         len = p->length;
                         
-                    iprintf("sending 0x%04x %d\r\n",setup->wValue, len);
+                    LOG("sending 0x%04x %d\r\n",setup->wValue, len);
                     usb_queue_tx(ep, p->addr, min(len, setup->wLength));
                     return;
                 }
                 p++;
             }
-            iprintf("NOT IMPLEMENTED! 0x%04x\r\n", setup->wValue);              
+            LOG("NOT IMPLEMENTED! 0x%04x\r\n", setup->wValue);              
             break;
             
         case mSET_ADDRESS:
@@ -435,14 +435,14 @@ static void usb_setup_device(endpoint_t *ep, USB_SETUP *setup)
             break;
             
         case mSET_CONFIG:
-            iprintf("setconfig: %d\r\n", setup->wValue);
+            LOG("setconfig: %d\r\n", setup->wValue);
             device_state = ENUMERATED;
             usb_set_config(setup->wValue);
             usb_tx(ep,0,0);                         // Send handshake
             break;
             
         default:
-            iprintf("NOT IMPLEMENTED! %d\r\n", setup->bRequest);
+            LOG("NOT IMPLEMENTED! %d\r\n", setup->bRequest);
             break;
     }
 }
@@ -481,14 +481,14 @@ static void usb_setup_interface(endpoint_t *ep, USB_SETUP *setup)
             break;
             
         default:
-            iprintf("setup_interface: %d\r\n", setup->bRequest);
+            LOG("setup_interface: %d\r\n", setup->bRequest);
             break;      
     }   
 }
 
 static void usb_setup_endpoint(endpoint_t *ep, USB_SETUP *setup)
 {
-    iprintf("setup_endpoint\r\n");      
+    LOG("setup_endpoint\r\n");      
 }
 
 static void usb_handler(uint8_t stat)
@@ -507,7 +507,7 @@ static void usb_handler(uint8_t stat)
             usb_tx_handler(ep, bdt_ptr);
             if(device_state == ADDRESS) {
                 USB0_ADDR = device_address;
-                iprintf("USB0_ADDR = %d\r\n", USB0_ADDR);
+                LOG("USB0_ADDR = %d\r\n", USB0_ADDR);
                 device_state = READY;       
             }
             ep->tx_last = i & 1;            // Save even/odd of last buffer sent
@@ -557,7 +557,7 @@ void USBOTG_IRQHandler(void)
     }
     
     if(istat & USB_ISTAT_ERROR_MASK) {
-        iprintf("USB error: 0x%x\r\n", USB0_ERRSTAT);
+        LOG("USB error: 0x%x\r\n", USB0_ERRSTAT);
         USB0_ISTAT = USB_ISTAT_ERROR_MASK;
         USB0_INTEN = 0;                             // Disable all USB interrupts
         return;